@@ -127,7 +127,7 @@ public:
             }
             if (readied > 2 * f && !delivered) {
                 delivered = true;
-                logger_ptr->log_event(CLOCK_PROCESS_CPUTIME_ID,
+                LOG(INFO, PACKET, CLOCK_PROCESS_CPUTIME_ID,
                     "DELIVERING MESSAGE: %s", mes_value.c_str());
                 std::cout << "[byzantine] " << em_id << " DELIVERING MESSAGE:" << mes_value << std::endl;
                 // raise(SIGSTOP);
@@ -353,7 +353,7 @@ public:
                (const struct sockaddr *) &recvaddr, sizeof(recvaddr)) == -1) {
             printf("[DUMMY] sendto error: %d\n", errno);
         }
-        logger_ptr->log_event(CLOCK_PROCESS_CPUTIME_ID, 
+        LOG(TRACE, PACKET, CLOCK_PROCESS_CPUTIME_ID, 
             "Send packet to proc %d (%s), message: %s", 
             target_em_id, addresses[target_em_id].first.c_str(), message.c_str());
     }
@@ -392,7 +392,7 @@ public:
             exit(1);
         }
 
-        logger_ptr->log_event(CLOCK_PROCESS_CPUTIME_ID,
+        LOG(TRACE, PACKET, CLOCK_PROCESS_CPUTIME_ID,
             "Recv packet fr proc %d (%s), message: %s",
             sender_id, addresses[sender_id].first.c_str(), buffer);
         return {sender_id, buffer};
@@ -466,7 +466,7 @@ public:
                     }
                 } while (sendsize != fileSize_toSend);
                 
-                logger_ptr->log_event(CLOCK_PROCESS_CPUTIME_ID, 
+                LOG(TRACE, PACKET, CLOCK_PROCESS_CPUTIME_ID, 
                     "Send file to proc %d (%s), size: %d", 
                     target_em_id, addresses[target_em_id].first.c_str(), sendsize);
                 sleep(1);
@@ -489,7 +489,7 @@ public:
                 return -1;
             }
 
-            logger_ptr->log_event(CLOCK_PROCESS_CPUTIME_ID, 
+            LOG(TRACE, PACKET, CLOCK_PROCESS_CPUTIME_ID, 
                 "Send packet to proc %d (%s), message: %s", 
                 target_em_id, addresses[target_em_id].first.c_str(), message.c_str());
             break;
@@ -573,7 +573,7 @@ public:
             
             strcpy(buffer, recvfilepath.c_str());
 
-            logger_ptr->log_event(CLOCK_PROCESS_CPUTIME_ID,
+            LOG(TRACE, PACKET, CLOCK_PROCESS_CPUTIME_ID,
                 "Recv file from proc %d (%s), size: %d, path: %s",
                 sender_id, addresses[sender_id].first.c_str(), n, buffer);
             break;
@@ -611,7 +611,7 @@ public:
                 std::cout << "[recvFile] sender not exist" << std::endl;
             }
 
-            logger_ptr->log_event(CLOCK_PROCESS_CPUTIME_ID,
+            LOG(TRACE, PACKET, CLOCK_PROCESS_CPUTIME_ID,
                 "Recv packet fr proc %d (%s), message: %s",
                 sender_id, addresses[sender_id].first.c_str(), buffer);
             break;
@@ -56,7 +56,7 @@ int main(int argc, char* argv[]) {
     // Create 2 instances in network-helper for send/recv
     NetworkHelper net_send = NetworkHelper(em_id, std::string(argv[2]));
     NetworkHelper net_recv = NetworkHelper(em_id, std::string(argv[2]));
-    logger_ptr->log_event(CLOCK_PROCESS_CPUTIME_ID, "Start of %d", em_id);
+    LOG(INFO, SCHED, CLOCK_PROCESS_CPUTIME_ID, "Start of %d", em_id);
 
     // std::cout << "[dummy] em_id: " << em_id << std::endl;
     // for (int i = 0; i < net.addresses.size(); i++) {
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "utils.hpp"
+
+/** @brief Writes records to a file from a background thread
+ *
+ * The producing thread only copies each record into a single-producer,
+ * single-consumer ring of bytes; a background thread drains the ring to
+ * the file in large `write` calls. A record is either appended whole or
+ * not at all. If the ring is full, the record is dropped (and counted)
+ * or the producer waits for space, depending on the mode.
+ *
+ * Only one thread may append.
+ */
+class AsyncWriter {
+
+    static const long IDLE_SLEEP_NS = MILLISECOND; ///< Flusher's sleep when ring is empty
+
+    int fd; ///< File written to (owned)
+    std::vector<char> ring; ///< Ring buffer, size is a power of 2
+    size_t mask; ///< ring.size() - 1
+    bool drop_when_full; ///< Drop records instead of waiting for space
+    std::atomic<size_t> head; ///< Bytes appended so far (written by producer)
+    std::atomic<size_t> tail; ///< Bytes written to file so far (written by flusher)
+    std::atomic<bool> stopping; ///< Set when flusher should drain and exit
+    unsigned long long dropped; ///< Records dropped at full ring
+    unsigned long long waits; ///< Appends which had to wait for space
+    std::thread flusher; ///< Background thread writing to fd
+
+public:
+
+    /** @brief Starts flusher thread writing to @p fd
+     *
+     * @param fd File to write to, closed by the writer
+     * @param capacity Size of the ring in bytes (rounded up to a power of 2)
+     * @param drop_when_full Drop records when ring is full instead of waiting
+     */
+    AsyncWriter(int fd, size_t capacity, bool drop_when_full);
+
+    /** @brief Writes everything appended, stops flusher and closes file
+     */
+    ~AsyncWriter();
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    /** @brief Appends record of @p len bytes
+     *
+     * @param data Record to be written
+     * @param len Length of the record
+     * @return False if record was dropped
+     */
+    bool append(const void* data, size_t len);
+
+    /** @brief Appends record consisting of @p count parts
+     *
+     * @param parts Parts of the record, written one after another
+     * @param count Number of parts
+     * @return False if record was dropped
+     */
+    bool append(const struct iovec* parts, int count);
+
+    unsigned long long get_dropped() const;
+    unsigned long long get_waits() const;
+
+private:
+
+    /** @brief Main loop of the flusher thread
+     */
+    void run();
+
+};
+
+AsyncWriter::AsyncWriter(int fd, size_t capacity, bool drop_when_full):
+        fd(fd), drop_when_full(drop_when_full), head(0), tail(0),
+        stopping(false), dropped(0), waits(0) {
+    size_t size = 4096;
+    while (size < capacity)
+        size *= 2;
+    ring.resize(size);
+    mask = size - 1;
+
+    /* Signals are handled by the emulator's thread, the flusher inherits
+       a mask blocking all of them from its very start */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    flusher = std::thread(&AsyncWriter::run, this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+AsyncWriter::~AsyncWriter() {
+    stopping.store(true, std::memory_order_release);
+    flusher.join();
+    close(fd);
+}
+
+bool AsyncWriter::append(const void* data, size_t len) {
+    struct iovec part = {const_cast<void*>(data), len};
+    return append(&part, 1);
+}
+
+bool AsyncWriter::append(const struct iovec* parts, int count) {
+    size_t len = 0, pos = head.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < count; ++i)
+        len += parts[i].iov_len;
+    if (len > ring.size()) {
+        dropped++;
+        return false;
+    }
+
+    if (ring.size() - (pos - tail.load(std::memory_order_acquire)) < len) {
+        if (drop_when_full) {
+            dropped++;
+            return false;
+        }
+        waits++;
+        while (ring.size() - (pos - tail.load(std::memory_order_acquire)) < len)
+            sched_yield();
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const char* src = (const char*)parts[i].iov_base;
+        size_t left = parts[i].iov_len;
+
+        while (left > 0) {
+            size_t chunk = std::min(left, ring.size() - (pos & mask));
+            memcpy(&ring[pos & mask], src, chunk);
+            pos += chunk;
+            src += chunk;
+            left -= chunk;
+        }
+    }
+    head.store(pos, std::memory_order_release);
+    return true;
+}
+
+unsigned long long AsyncWriter::get_dropped() const {
+    return dropped;
+}
+
+unsigned long long AsyncWriter::get_waits() const {
+    return waits;
+}
+
+/* PRIVATE METHODS */
+
+void AsyncWriter::run() {
+    size_t pos = tail.load(std::memory_order_relaxed);
+
+    while (true) {
+        bool stop = stopping.load(std::memory_order_acquire);
+        size_t end = head.load(std::memory_order_acquire);
+
+        if (pos == end) {
+            if (stop)
+                return; /* Everything written */
+            real_sleep(IDLE_SLEEP_NS);
+            continue;
+        }
+
+        /* Write up to the end of the ring at once */
+        size_t chunk = std::min(end - pos, ring.size() - (pos & mask));
+        ssize_t written = write(fd, &ring[pos & mask], chunk);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("AsyncWriter write");
+            written = chunk; /* Skip it, don't block the producer */
+        }
+        pos += written;
+        tail.store(pos, std::memory_order_release);
+    }
+}
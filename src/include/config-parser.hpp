@@ -1,5 +1,14 @@
 #pragma once
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -7,10 +16,50 @@
 #include <vector>
 
 #include "utils.hpp"
+#include "network/latency_table.hpp"
 
 std::string CONFIG_PATH("./configs/config.txt"); ///< Path to configuration file (default)
 const int STEPS = 1000; ///< Number of times emulator awakens some process
 
+/** @brief Capacity of a directed link (or of all links if src is -1)
+ */
+struct LinkCapacity {
+    int src; ///< Sending process (-1 for all links)
+    int dest; ///< Receiving process (-1 for all links)
+    long long bandwidth; ///< Bandwidth in bits per second
+    long long queue; ///< Size of the queue in front of the link in bytes
+};
+
+#define BINARY_CONFIG_MAGIC "TINYEMCF" ///< First 8 bytes of a binary config
+#define BINARY_CONFIG_VERSION 1 ///< Version of binary config layout
+
+/** @brief Header of a binary config file
+ *
+ * Followed by sections at given offsets (from the beginning of the file,
+ * 8-byte aligned): addresses (in_addr_t[procs]), ports (int[procs]),
+ * latency table (as in @ref LatencyTable::get_data), programs 
+ * (uint64_t[procs + 1] offsets into a blob of NUL-terminated program 
+ * lines following them) and capacities (LinkCapacity[capacities]).
+ * All values in host byte order (addresses in network byte order).
+ */
+struct BinaryConfigHeader {
+    char magic[8]; ///< BINARY_CONFIG_MAGIC, without NUL
+    uint32_t version; ///< BINARY_CONFIG_VERSION
+    uint32_t procs; ///< Number of processes
+    char tun_dev_name[16]; ///< Device name for TUN interface
+    char tun_addr[16]; ///< Address of TUN interface
+    char tun_mask[16]; ///< Mask of TUN interface subnetwork
+    uint32_t latency_mode; ///< LatencyTable::Mode of latency section
+    uint32_t regions; ///< Number of regions (REGIONS mode) or hubs (EDGES mode)
+    uint64_t capacities; ///< Number of link capacities
+    uint64_t addrs_offset; ///< Offset of addresses section
+    uint64_t ports_offset; ///< Offset of ports section
+    uint64_t latency_offset; ///< Offset of latency section
+    uint64_t programs_offset; ///< Offset of programs section
+    uint64_t capacities_offset; ///< Offset of capacities section
+    uint64_t size; ///< Size of the whole file
+};
+
 /** @brief Class parsing and saving the configuration from a file
  */
 class ConfigParser {
@@ -26,34 +75,99 @@ public:
      * - Second line consists of one number - procs - num of procs to simulate
      * - Next procs lines consists of a string and int each, 
      *   i-th line means the address and port on which i-th proc is listening
-     * - Next procs lines consists of procs numbers each, i-th number in
-     *   j-th line means the latency from i-th to j-th proc in miliseconds
-     *   (i-th number in i-th column should be 0)
+     * - Latencies in one of the forms (all in miliseconds):
+     *   - procs lines consisting of procs numbers each, i-th number in
+     *     j-th line means the latency from i-th to j-th proc
+     *     (i-th number in i-th column should be 0),
+     *   - `regions <R>` line, a line with region id (from 0 to R-1) of every
+     *     proc, and R lines of R numbers each - latencies between regions
+     *     (i-th number in i-th line is latency inside i-th region),
+     *   - `edges <M>` line and M lines `<i> <j> <latency>`, each being an 
+     *     undirected link, latency of procs is the shortest path between
+     *     them (at most 65535 ms, see @ref LatencyTable).
+     *   Latencies can't be negative, and 1 <= R <= procs.
      * - Next procs lines consist of at least two words each, i-th line 
      *   starts with the path to i-th program, then the name of the i-th program
      *   and then whitespace-split args to the i-th program.
+     * - Optionally, lines limiting capacity of links follow (without them 
+     *   links have infinite bandwidth):
+     *   - `bandwidth <Mbit/s> <queue KB>` for every link,
+     *   - `link <i> <j> <Mbit/s> <queue KB>` for the link from i-th to j-th
+     *     proc, overriding the former whether given before or after it.
      * 
+     * If the file is a binary config (see @ref BinaryConfigHeader), it is
+     * mapped, and the latency table is used in place. Program lines are
+     * then kept whole in program_paths, with empty program_args.
      */
     ConfigParser(const std::string& config_path);
+    ~ConfigParser();
+
+    ConfigParser(const ConfigParser&) = delete;
+    ConfigParser& operator=(const ConfigParser&) = delete;
+
+    /** \brief Writes config to @p path in the binary format
+     *
+     * @param path File to be written
+     * @return False on failure (errno is set)
+     */
+    bool save_binary(const std::string& path) const;
 
     std::string tun_dev_name; ///< Device name for new TUN interface
     std::string tun_addr; ///< Address of the TUN interface
     std::string tun_mask; ///< Mask of the TUN interface subnetwork
     int procs; ///< Number of processes to be emulated by the emulator
-    std::vector<std::vector<int>> latency; ///< Matrix of pairwise latencies
-    std::vector<std::pair<std::string, int>> addresses; ///< Addresses (in number/dot format) and ports of processes
+    LatencyTable latency; ///< Pairwise latencies
+    std::vector<in_addr_t> addrs; ///< Addresses of processes (network byte order)
+    std::vector<int> ports; ///< Ports of processes
     std::vector<std::string> program_paths; ///< Paths to programs to be run on every process
     std::vector<std::string> program_names; ///< Names of programs to be run on every process
     std::vector<std::vector<std::string>> program_args; ///< Arguments to be passed to every process
+    std::vector<LinkCapacity> capacities; ///< Limited capacities of links, in config order
+
+private:
+
+    void* mapping; ///< Mapped binary config (nullptr for text config)
+    size_t mapping_size; ///< Size of the mapping
+
+    /** @brief Maps binary config from @p fd, exits if it's corrupted
+     */
+    void load_binary(int fd, const std::string& config_path);
+
+    /** @brief Reads procs x procs matrix, starting with @p first number
+     */
+    void read_dense_latency(std::istream& config, int first);
+
+    /** @brief Reads regions of procs and latencies between regions
+     */
+    void read_region_latency(std::istream& config);
+
+    /** @brief Reads links and computes shortest paths over them
+     */
+    void read_edge_latency(std::istream& config);
 
 };
 
 
-ConfigParser::ConfigParser(const std::string& config_path) {
+ConfigParser::ConfigParser(const std::string& config_path): mapping(nullptr), 
+        mapping_size(0) {
+    char magic[8];
+    int fd = open(config_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd >= 0) {
+        if (read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+                memcmp(magic, BINARY_CONFIG_MAGIC, sizeof(magic)) == 0) {
+            load_binary(fd, config_path);
+            close(fd);
+            return;
+        }
+        close(fd);
+    }
+
     std::ifstream config(config_path);
     std::istringstream args_stream;
-    std::string address, program_path, args_line, arg;
-    int port, lat;
+    std::string address, program_path, args_line, arg, keyword;
+    int port, src, dest;
+    double mbits, queue_kb;
 
     if (! config.is_open()) { 
         std::cerr << "Couldn't open config file for reading. (" << config_path << ")" << std::endl;
@@ -64,25 +178,21 @@ ConfigParser::ConfigParser(const std::string& config_path) {
 
     for (int i = 0; i < procs; ++i) {
         config >> address >> port;
-        addresses.push_back(std::make_pair(address, port));
+        addrs.push_back(inet_addr(address.c_str()));
+        ports.push_back(port);
     }
 
-    for (int i = 0; i < procs; ++i) {
-        latency.push_back(std::vector<int>());
-
-        for (int j = 0; j < procs; ++j) {
-            config >> lat;
-            if (i == j && lat != 0) {
-                std::cout << "NETWORK CONFIG NON-ZERO AT DIAGONAL" << std::endl;
-                exit(1);
-            }
-            latency.back().push_back(lat * MILLISECOND); // latency is given in miliseconds
-        }
-    }
+    config >> keyword;
+    if (keyword == "regions")
+        read_region_latency(config);
+    else if (keyword == "edges")
+        read_edge_latency(config);
+    else
+        read_dense_latency(config, std::stoi(keyword));
 
     std::getline(config, args_line); // Read emptyline 
 
-    for (int i = 0; i < procs * 2; ++i) {
+    for (int i = 0; i < procs; ++i) {
         std::getline(config, args_line);
         args_stream = std::istringstream(args_line);
         program_args.push_back(std::vector<std::string>());
@@ -102,4 +212,236 @@ ConfigParser::ConfigParser(const std::string& config_path) {
         // std::cout << "[config-parser.hpp]" << std::endl;
     }
 
+    while (config >> keyword) {
+        if (keyword == "bandwidth") {
+            config >> mbits >> queue_kb;
+            src = dest = -1;
+        }
+        else if (keyword == "link") {
+            config >> src >> dest >> mbits >> queue_kb;
+        }
+        else {
+            std::cout << "UNKNOWN NETWORK CONFIG LINE: " << keyword << std::endl;
+            exit(1);
+        }
+        if (!config || mbits <= 0 || queue_kb < 0 || src >= procs || dest >= procs ||
+                (keyword == "link" && (src < 0 || dest < 0))) {
+            std::cout << "INVALID " << keyword << " CONFIG LINE" << std::endl;
+            exit(1);
+        }
+        capacities.push_back({src, dest, (long long)(mbits * 1e6), (long long)(queue_kb * 1024)});
+    }
+
+}
+
+ConfigParser::~ConfigParser() {
+    if (mapping)
+        munmap(mapping, mapping_size);
+}
+
+bool ConfigParser::save_binary(const std::string& path) const {
+    auto align = [](uint64_t offset) { return (offset + 7) & ~(uint64_t)7; };
+    std::vector<uint64_t> program_offsets;
+    std::string programs_blob;
+    BinaryConfigHeader header;
+
+    for (int i = 0; i < procs; ++i) {
+        program_offsets.push_back(programs_blob.size());
+        programs_blob += program_paths[i];
+        for (const auto& arg: program_args[i])
+            programs_blob += " " + arg;
+        programs_blob += '\0';
+    }
+    program_offsets.push_back(programs_blob.size());
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_CONFIG_MAGIC, sizeof(header.magic));
+    header.version = BINARY_CONFIG_VERSION;
+    header.procs = procs;
+    strncpy(header.tun_dev_name, tun_dev_name.c_str(), sizeof(header.tun_dev_name) - 1);
+    strncpy(header.tun_addr, tun_addr.c_str(), sizeof(header.tun_addr) - 1);
+    strncpy(header.tun_mask, tun_mask.c_str(), sizeof(header.tun_mask) - 1);
+    header.latency_mode = (uint32_t)latency.get_mode();
+    header.regions = latency.get_regions();
+    header.capacities = capacities.size();
+    header.addrs_offset = align(sizeof(header));
+    header.ports_offset = align(header.addrs_offset + procs * sizeof(in_addr_t));
+    header.latency_offset = align(header.ports_offset + procs * sizeof(int));
+    header.programs_offset = align(header.latency_offset + latency.get_data_size());
+    header.capacities_offset = align(header.programs_offset + 
+        program_offsets.size() * sizeof(uint64_t) + programs_blob.size());
+    header.size = header.capacities_offset + capacities.size() * sizeof(LinkCapacity);
+
+    std::vector<char> file(header.size, 0);
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + header.addrs_offset, addrs.data(), procs * sizeof(in_addr_t));
+    memcpy(file.data() + header.ports_offset, ports.data(), procs * sizeof(int));
+    latency.get_data(file.data() + header.latency_offset);
+    memcpy(file.data() + header.programs_offset, program_offsets.data(), 
+        program_offsets.size() * sizeof(uint64_t));
+    memcpy(file.data() + header.programs_offset + program_offsets.size() * sizeof(uint64_t),
+        programs_blob.data(), programs_blob.size());
+    memcpy(file.data() + header.capacities_offset, capacities.data(), 
+        capacities.size() * sizeof(LinkCapacity));
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(file.data(), file.size());
+    return (bool)out;
+}
+
+void ConfigParser::load_binary(int fd, const std::string& config_path) {
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(BinaryConfigHeader)) {
+        std::cout << "BINARY CONFIG TOO SHORT (" << config_path << ")" << std::endl;
+        exit(1);
+    }
+    mapping_size = st.st_size;
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+        panic("mmap config");
+
+    const char* base = (const char*)mapping;
+    const BinaryConfigHeader* header = (const BinaryConfigHeader*)base;
+    auto corrupted = [&config_path]() {
+        std::cout << "BINARY CONFIG VERSION MISMATCH OR CORRUPTED (" << config_path << ")" << std::endl;
+        exit(1);
+    };
+    /* Whether count elements of elem_size bytes at offset are inside 
+       the file (and aligned), without overflowing */
+    auto section_fits = [this](uint64_t offset, uint64_t count, uint64_t elem_size) {
+        return offset % 8 == 0 && offset <= mapping_size &&
+               count <= (mapping_size - offset) / elem_size;
+    };
+
+    if (header->version != BINARY_CONFIG_VERSION || header->size != mapping_size ||
+            header->procs > INT_MAX || header->regions > INT_MAX ||
+            header->latency_mode > (uint32_t)LatencyTable::Mode::EDGES)
+        corrupted();
+
+    procs = header->procs;
+    LatencyTable::Mode latency_mode = (LatencyTable::Mode)header->latency_mode;
+    size_t latency_size = LatencyTable::data_size(latency_mode, procs, header->regions);
+    if (!section_fits(header->addrs_offset, procs, sizeof(in_addr_t)) ||
+            !section_fits(header->ports_offset, procs, sizeof(int)) ||
+            !section_fits(header->latency_offset, latency_size, 1) ||
+            !section_fits(header->programs_offset, (uint64_t)procs + 1, sizeof(uint64_t)) ||
+            !section_fits(header->capacities_offset, header->capacities, sizeof(LinkCapacity)) ||
+            header->capacities_offset + header->capacities * sizeof(LinkCapacity) != mapping_size)
+        corrupted();
+
+    /* Ids and latencies are checked, and the highest latency (bounding 
+       lookahead) is recomputed rather than trusted */
+    if (!latency.set_view(latency_mode, procs, header->regions, base + header->latency_offset))
+        corrupted();
+
+    /* Program lines are NUL-terminated inside the blob, which ends
+       at the last offset */
+    const uint64_t* program_offsets = (const uint64_t*)(base + header->programs_offset);
+    const char* programs_blob = (const char*)(program_offsets + procs + 1);
+    uint64_t blob_size = program_offsets[procs];
+    if (!section_fits(programs_blob - base, blob_size, 1))
+        corrupted();
+    for (int i = 0; i < procs; ++i) {
+        if (program_offsets[i] >= blob_size ||
+                !memchr(programs_blob + program_offsets[i], '\0', blob_size - program_offsets[i]))
+            corrupted();
+    }
+
+    const LinkCapacity* capacities_section = (const LinkCapacity*)(base + header->capacities_offset);
+    for (uint64_t i = 0; i < header->capacities; ++i) {
+        const LinkCapacity& capacity = capacities_section[i];
+        if (capacity.src < -1 || capacity.src >= procs || capacity.dest < -1 || 
+                capacity.dest >= procs || (capacity.src < 0) != (capacity.dest < 0) ||
+                capacity.bandwidth <= 0 || capacity.queue < 0)
+            corrupted();
+    }
+
+    tun_dev_name.assign(header->tun_dev_name, strnlen(header->tun_dev_name, sizeof(header->tun_dev_name)));
+    tun_addr.assign(header->tun_addr, strnlen(header->tun_addr, sizeof(header->tun_addr)));
+    tun_mask.assign(header->tun_mask, strnlen(header->tun_mask, sizeof(header->tun_mask)));
+
+    const in_addr_t* addrs_section = (const in_addr_t*)(base + header->addrs_offset);
+    const int* ports_section = (const int*)(base + header->ports_offset);
+    addrs.assign(addrs_section, addrs_section + procs);
+    ports.assign(ports_section, ports_section + procs);
+
+    program_paths.reserve(procs);
+    program_args.resize(procs);
+    for (int i = 0; i < procs; ++i)
+        program_paths.emplace_back(programs_blob + program_offsets[i]);
+
+    capacities.assign(capacities_section, capacities_section + header->capacities);
+}
+
+void ConfigParser::read_dense_latency(std::istream& config, int first) {
+    std::vector<int> matrix;
+    int lat = first;
+
+    matrix.reserve((size_t)procs * procs);
+    for (int i = 0; i < procs; ++i) {
+        for (int j = 0; j < procs; ++j) {
+            if (i != 0 || j != 0)
+                config >> lat;
+            if (i == j && lat != 0) {
+                std::cout << "NETWORK CONFIG NON-ZERO AT DIAGONAL" << std::endl;
+                exit(1);
+            }
+            matrix.push_back(lat * MILLISECOND); // latency is given in miliseconds
+        }
+    }
+    if (!latency.set_dense(procs, std::move(matrix))) {
+        std::cout << "NETWORK CONFIG NEGATIVE LATENCY" << std::endl;
+        exit(1);
+    }
+}
+
+void ConfigParser::read_region_latency(std::istream& config) {
+    std::vector<int> region_of(procs), matrix;
+    int regions, lat;
+
+    config >> regions;
+    if (regions <= 0 || regions > procs) {
+        std::cout << "NETWORK CONFIG REGIONS OUT OF RANGE (1 TO PROCS)" << std::endl;
+        exit(1);
+    }
+    for (int i = 0; i < procs; ++i) {
+        config >> region_of[i];
+        if (region_of[i] < 0 || region_of[i] >= regions) {
+            std::cout << "NETWORK CONFIG REGION OUT OF RANGE" << std::endl;
+            exit(1);
+        }
+    }
+    for (int i = 0; i < regions * regions; ++i) {
+        config >> lat;
+        matrix.push_back(lat * MILLISECOND);
+    }
+    if (!latency.set_regions(std::move(region_of), regions, std::move(matrix))) {
+        std::cout << "NETWORK CONFIG NEGATIVE LATENCY" << std::endl;
+        exit(1);
+    }
+}
+
+void ConfigParser::read_edge_latency(std::istream& config) {
+    std::vector<LatencyTable::Edge> edges;
+    LatencyTable::Edge edge;
+    int count;
+
+    config >> count;
+    for (int i = 0; i < count; ++i) {
+        config >> edge.src >> edge.dest >> edge.latency;
+        if (edge.src < 0 || edge.src >= procs || edge.dest < 0 || edge.dest >= procs) {
+            std::cout << "NETWORK CONFIG EDGE OUT OF RANGE" << std::endl;
+            exit(1);
+        }
+        if (edge.latency < 0) {
+            std::cout << "NETWORK CONFIG NEGATIVE LATENCY" << std::endl;
+            exit(1);
+        }
+        edges.push_back(edge);
+    }
+    if (!latency.set_edges(procs, edges)) {
+        std::cout << "NETWORK CONFIG NOT CONNECTED (OR PATH OVER 65535 MS)" << std::endl;
+        exit(1);
+    }
 }
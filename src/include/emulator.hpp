@@ -8,13 +8,34 @@
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <memory>
 
 #include "utils.hpp"
 #include "logger.hpp"
+#include "stats_page.hpp"
+#include "profiler.hpp"
 #include "config-parser.hpp"
 #include "network/network.hpp"
+#include "network/link_model.hpp"
+#include "network/schedule_log.hpp"
+#include "network/pcap_capture.hpp"
 #include "proc_control/emproc.hpp"
 #include "proc_control/proc_frame.hpp"
+#include "proc_control/proc_queue.hpp"
+#include "proc_control/lookahead.hpp"
+#include "proc_control/quantum_policy.hpp"
+#include "proc_control/cgroup.hpp"
+#include "proc_control/launcher.hpp"
+
+/** @brief Conditions on which emulation stops (negative value - no limit)
+ * 
+ * Emulation always stops when every emulated process has exited.
+ */
+struct StopCondition {
+    long long steps; ///< Number of awakenings to perform
+    long long horizon; ///< Virtual time (ns) all running processes have to reach
+    long long wall_budget; ///< Real time (ns) the emulation may take
+};
 
 /** @brief Class encapsulating the main logic of the emulator.
  * 
@@ -27,113 +48,244 @@
  */
 class Emulator {
 
+    static const int KILL_GRACE_MS = 1000; ///< Time processes have to exit after SIGINT
+    static const long long MIN_EPOCH_QUANTUM = 100 * MICROSECOND; ///< Shortest quantum of an epoch member
+    static const int RECEIVE_BATCH = 64; ///< Packets read at most between checks of running quanta
+
     int procs; ///< Number of processes being emulated.
+    std::unique_ptr<Cgroup> cgroup_root; ///< Parent of cgroups of all processes (nullptr if not used)
     std::vector<EMProc> emprocs; ///< States of each process
+    ProcQueue proc_queue; ///< Processes ordered by their virtual clocks
     Network& network; ///< Specifies network on which the emulation is being run
+    Lookahead lookahead; ///< Incoming latency bounds used for safe windows
+    AwakePoller poller; ///< Blocking wait on TUN FD and timers during awakenings
+    QuantumPolicy policy; ///< Extends and batches windows, measures error it causes
+    LinkModel links; ///< Bandwidth and queues of links
+    std::unique_ptr<ScheduleRecorder> recorder; ///< Log of delivery schedule (nullptr if not recorded)
+    std::unique_ptr<ScheduleReplayer> replayer; ///< Recorded schedule to enforce (nullptr if not replayed)
+    std::unique_ptr<PcapCapture> pcap; ///< Capture of routed packets (nullptr if not captured)
+    std::unique_ptr<StatsPage> stats_page; ///< Live counters in shared memory (nullptr if not published)
 
 public:
 
     /** @brief Creates an emulation and spawns specified number of new processes.
      * 
-     * Creates the emulation by forking the process @ref procs times. 
-     * Every newly created process immediately stops itself by the 
-     * `raise(SIGSTOP)` call. Objects corresponding to
-     * newly created processes are stored in the @ref emprocs vector.
+     * Creates the emulation by spawning @ref procs processes with 
+     * @p launcher. Every newly created process immediately stops itself, 
+     * and the constructor returns once all of them did. Objects 
+     * corresponding to newly created processes are stored in the 
+     * @ref emprocs vector. Time it took is reported.
      * 
      * @param network The network on which the emulator runs
      * @param cp Configuration of the emulation
+     * @param clock_mode How virtual clocks of processes advance
+     * @param policy How windows are turned into quanta
+     * @param use_freezer Put every process into its own cgroup and
+     *        freeze it instead of stopping it with signals
+     * @param launcher Launcher used to spawn the programs
+     */
+    Emulator(Network& network, const ConfigParser& cp, 
+             ClockMode clock_mode = ClockMode::WALL,
+             const QuantumPolicy& policy = QuantumPolicy(),
+             bool use_freezer = false,
+             const Launcher& launcher = Launcher());
+
+    /** @brief Creates an emulation of nodes without processes
+     * 
+     * Every node sends a packet read from @p network (a generator, see
+     * @ref LoopbackNetwork) every @p send_period of its virtual time, see
+     * @ref EMProc::generate. Nothing is spawned, so scheduling and
+     * packet routing run without any kernel I/O or signals.
+     * 
+     * @param network The network generating the packets
+     * @param cp Configuration of the emulation (programs are ignored)
+     * @param send_period Virtual time between packets of a node (ns)
+     * @param policy How windows are turned into quanta
      */
-    Emulator(Network& network, const ConfigParser& cp);
+    Emulator(Network& network, const ConfigParser& cp, long long send_period,
+             const QuantumPolicy& policy = QuantumPolicy());
 
     /** @brief Starts the emulation by iteratively scheduling processes.
      * 
-     * Performs @p steps times the loop of choosing the next process to 
-     * schedule, calculating for what time it should run, awakening it
+     * Performs the loop of choosing the next process to schedule, 
+     * calculating for what time it should run, awakening it
      * for that time, and later sorting packets sent by it to appropriate  
-     * queues.
+     * queues, until @p stop is met. Processes which exited are no 
+     * longer scheduled.
      * 
-     * @param steps Number of awakenings to perform
+     * @param stop When to stop the emulation
      */
-    void start_emulation(int steps);
+    void start_emulation(const StopCondition& stop);
+
+    /** @brief Starts the emulation in YAWNS-style epochs of concurrently
+     *         running processes.
+     * 
+     * Every epoch computes the horizon below which no packet sent
+     * during the epoch can arrive (@ref Lookahead::epoch_horizon), and
+     * awakens every process whose clock is below it at once, each up to
+     * the horizon (see @ref awake_together). The process with the lowest
+     * clock is always in the epoch, and every member runs for at least
+     * @ref MIN_EPOCH_QUANTUM, so epochs make progress even when some
+     * latency is 0 (such a member may overrun the horizon, as
+     * accounted by @ref policy).
+     * 
+     * Packets are attributed to their senders by source address, so
+     * @p network has to keep it (@ref Network::attributes_senders),
+     * otherwise returns at once. Nodes without processes need no
+     * attribution.
+     * 
+     * @param stop When to stop the emulation
+     */
+    void start_epoch_emulation(const StopCondition& stop);
 
     /** @brief Kills all spawned processes 
      * 
      * Kills all spawned processes, effectively ending the emulation.
+     * Processes in cgroups are killed together with all their descendants,
+     * and the cgroups are removed. All processes are told to exit first,
+     * and then waited for at once (@ref Launcher::reap). Time it took is
+     * reported.
      */
     void kill_emulation();
 
+    /** @brief Records delivery schedule of the emulation to @p path
+     *
+     * Every routed packet is logged with its virtual send time, sender,
+     * receiver, size and delivery time (or drop), see 
+     * @ref ScheduleRecorder. The log is complete once 
+     * @ref kill_emulation returns.
+     * 
+     * @param path File to be written
+     */
+    void record_schedule(const std::string& path);
+
+    /** @brief Delivers packets at times recorded in @p path
+     *
+     * Delivery times (and drops) come from the log instead of latencies
+     * and @ref links, see @ref ScheduleReplayer.
+     * 
+     * @param path Log written by @ref record_schedule
+     */
+    void replay_schedule(const std::string& path);
+
+    /** @brief Captures every routed packet to pcapng file @p path
+     *
+     * Packets are captured with the address of the sender as source
+     * and the address of the receiver as destination, see 
+     * @ref PcapCapture. The file is complete once @ref kill_emulation
+     * returns.
+     * 
+     * @param path File to be written
+     */
+    void capture_packets(const std::string& path);
+
+    /** @brief Publishes live counters to shared memory object @p name
+     *
+     * Counters of every process (see @ref ProcStats) are published a
+     * few times a second and when the emulation ends, see 
+     * @ref StatsPage. The object is removed by @ref kill_emulation.
+     * 
+     * @param name Name of the shared memory object (starting with '/')
+     */
+    void publish_stats(const std::string& name);
+
+    /** @brief Prints statistics of the quantum policy, links, 
+     *         schedule record/replay and capture
+     */
+    void print_stats() const;
+
 private:
 
-    /** @brief Forks the process and initializes child processes
+    /** @brief Starts all processes stopped, waiting until every one is
      * 
-     * Creates @ref procs new processes that execute
-     * the @ref child_init function. Saves process ids of newly
-     * created processes in the @p pids array.
+     * Spawns @ref procs programs from @p cp with @p launcher first, then
+     * waits for their stops, so the startup of all of them overlaps.
+     * Saves process ids of new processes in the @p pids array.
      * 
      * @param pids Array in which to store process ids of new processes
      * @param cp Configuration to be used for new processes initialization
+     * @param launcher Launcher used to spawn the programs
      */
-    void fork_stop_run(int* pids, const ConfigParser& cp);
+    void spawn_stopped(int* pids, const ConfigParser& cp, const Launcher& launcher);
 
-    /** @brief Extracts the name of the program from its path
-     * 
-     * Extracts the name of the program from its path. If the path
-     * contains '/' character, the name is everything after the last
-     * occurence of that character. Otherwise, the name is the entire
-     * path.
+    /** @brief Moves every process into its own frozen cgroup
      * 
-     * @param filePath Path to the program
-     * @return Name of the program
+     * Creates `tinyem.<pid>/node<em_id>` below the emulator's own cgroup.
+     * Every process (already stopped by itself) is moved into its cgroup, 
+     * the cgroup is frozen and the process continued, so it runs only
+     * when the cgroup is thawed. Leaves signals in use if cgroup v2 is
+     * not available.
      */
-    const char* extractProgramName(const char* filePath);
+    void place_in_cgroups();
 
-    /** @brief Executes the program specified by @p program_path
+    /** @brief Chooses next process to be scheduled for awakening
      * 
-     * Executes the program specified by @p program_path with arguments
-     * specified by @p program_args. The program is executed using the
-     * `system()` call.
+     * Returns the process which was executed for the least amount of time
+     * (lowest em_id on ties), as kept on top of @ref proc_queue.
      * 
-     * @param program_path Path to the program to be executed
-     * @param program_args Arguments to be passed to the program
+     * @return Id of the process to be scheduled next
      */
-    void executeProgram(const std::string& program_path, const std::vector<std::string>& program_args);
+    em_id_t choose_next_proc() const;
 
-    /** @brief Initialize the child process.
+    /** @brief Awakens @p members at once, each for its quantum from 
+     *         @p windows
      * 
-     * Start by doing the `raise(SIGSTOP)` call. After the
-     * process is awaken (using the `SIGCONT` signal), it
-     * executes the program specified by @p program_path.
+     * Members without process are advanced first, in no real time.
+     * Runs the steps of @ref EMProc::awake for other members in one loop:
+     * members whose quantum ran out are stopped, due packets are
+     * delivered to the others, and packets read from @ref network are 
+     * stored by their senders (@ref receive_attributed). When there is 
+     * nothing to do, the loop blocks in @ref poller until a packet
+     * arrives, or the earliest delivery or quantum end is due.
      * 
-     * @param program_path Path to the program to be executed on this process
-     * @param program_name Name of the program to be executed on this process
-     * @param program_args Arguments to be passes to the program
+     * @param members Processes to awaken
+     * @param windows Quantum of every member in nanoseconds
      */
-    void child_init( 
-        const std::string& program_path,
-        // const std::string& program_name, 
-        const std::vector<std::string>& program_args);
+    void awake_together(const std::vector<em_id_t>& members, 
+                        const std::vector<long long>& windows);
 
-    /** @brief Chooses next process to be scheduled for awakening
+    /** @brief Reads up to @ref RECEIVE_BATCH packets from @ref network,
+     *         storing each of them by the process with its source address
      * 
-     * Loops through all te processes and choses the one which was executed
-     * for the least amount of time.
+     * Packets are stamped with the current virtual time of the sender.
+     * Packets not sent by an emulated process are dropped.
      * 
-     * @return Id of the process to be scheduled next
+     * @return Number of packets read
      */
-    em_id_t choose_next_proc() const;
+    int receive_attributed();
 
     /** @brief Returns the longest time @p em_id can run 
      *         without violating correctness
      *
-     * Every process has its virtual clock saved, returns 
-     * minimum (over all processes p != @p em_id ) of 
+     * Returns the distance from the virtual clock of @p em_id to the
+     * earliest possible arrival of a packet at it, as bounded by
+     * @ref lookahead:
      * \code{}
-     * p->virtual_clock - em_id->virtual_clock + network.get_latency(p, em_id)
+     * min(p->virtual_clock, p != em_id) + min_in_latency(em_id) - em_id->virtual_clock
      * \endcode
+     * capped at twice the maximum latency (times the batch size), and 
+     * adjusted by @ref policy.
      * @param em_id Process which will be run
      * @return The maximum possible time to run
      */
-    struct timespec get_time_interval(em_id_t em_id) const;
+    struct timespec get_time_interval(em_id_t em_id);
+
+    /** @brief Checks whether emulation should stop
+     * 
+     * @param stop Conditions on which emulation stops
+     * @param loop Number of awakenings performed so far
+     * @param start_time CLOCK_MONOTONIC time at which emulation started
+     * @return If any of the conditions is met, or no process is left
+     */
+    bool should_stop(const StopCondition& stop, long long loop, 
+                     struct timespec start_time) const;
+
+    /** @brief Puts @p em_id back into @ref proc_queue with its new clock 
+     *         after an awakening, or removes it if it exited
+     * 
+     * @param em_id Process which was just awakened
+     */
+    void requeue(em_id_t em_id);
 
     /** @brief Moves packets sent by @p em_id to appropriate in queues of 
      *         receiving processes.
@@ -141,197 +293,398 @@ private:
      * For every packet sent by the @p em_id, this function moves it to 
      * a queue of packets awaiting to be received by appropriate other process.
      * The function increases the timestamp of the packet by the pairwise
-     * latency between those two processes - so that the packet will be 
-     * received at proper time.
+     * latency between those two processes, and by the queueing and 
+     * serialization delay of @ref links - so that the packet will be 
+     * received at proper time. Packets not fitting into link queues are
+     * dropped. When replaying, the recorded delivery time is used
+     * instead; when recording, the decision is logged.
      * 
      * @param em_id Id of the process whose out packets need to be moved
      */
     void schedule_sent_packets(em_id_t em_id);
 
+    /** @brief Writes snapshot of counters to @ref stats_page, if one is
+     *         due (or @p finished)
+     * 
+     * @param steps Awakenings performed so far
+     * @param finished Whether emulation has ended
+     */
+    void update_stats(long long steps, bool finished = false);
+
 };
 
-Emulator::Emulator(Network& network, const ConfigParser& cp): network(network) {
-    procs = network.get_procs();   
+Emulator::Emulator(Network& network, const ConfigParser& cp, ClockMode clock_mode,
+                   const QuantumPolicy& policy, bool use_freezer,
+                   const Launcher& launcher): 
+        procs(network.get_procs()), proc_queue(procs), network(network),
+        lookahead(network), poller(network.get_fd()), policy(policy), links(cp) {
 
     int children_pids[procs];
-    fork_stop_run(children_pids, cp); 
+    struct timespec start_time;
+    char buf[BUF_SIZE];
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    spawn_stopped(children_pids, cp, launcher); 
 
     for (em_id_t em_id = 0; em_id < procs; ++em_id) {
-        emprocs.push_back(EMProc(em_id, children_pids[em_id]));
+        emprocs.push_back(EMProc(em_id, children_pids[em_id], clock_mode));
+        proc_queue.push(em_id, nano_from_ts(emprocs[em_id].virtual_clock));
     }
+    if (use_freezer)
+        place_in_cgroups();
+
+    snprintf(buf, sizeof(buf), "Spawned %d processes in %.3f ms\n", procs,
+        (double)nano_from_ts(get_time_since(start_time)) / MILLISECOND);
+    Logger::print_string_safe(buf);
 
-    logger_ptr->log_event("Emulator created with %d processes", procs);                  
+    LOG(INFO, SCHED, "Emulator created with %d processes", procs);                  
 }
 
-void Emulator::start_emulation(int steps) {
+Emulator::Emulator(Network& network, const ConfigParser& cp, long long send_period,
+                   const QuantumPolicy& policy): 
+        procs(network.get_procs()), proc_queue(procs), network(network),
+        lookahead(network), poller(network.get_fd()), policy(policy), links(cp) {
+
+    for (em_id_t em_id = 0; em_id < procs; ++em_id) {
+        /* Spread over the period, so nodes don't all send at once */
+        emprocs.push_back(EMProc(em_id, send_period, send_period * em_id / procs));
+        proc_queue.push(em_id, nano_from_ts(emprocs[em_id].virtual_clock));
+    }
+
+    LOG(INFO, SCHED, "Emulator created with %d nodes without processes", procs);
+}
+
+void Emulator::start_emulation(const StopCondition& stop) {
     em_id_t em_id;
-    struct timespec ts;
-    
-    for (int loop = 0; loop < steps; ++loop) {
-        em_id = choose_next_proc();
-        ts = get_time_interval(em_id);
-        emprocs[em_id].awake(ts, network);
+    struct timespec ts, start_time;
+    long long loop;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    Profiler::instance().start_run();
+    for (loop = 0; !should_stop(stop, loop, start_time); ++loop) {
+        {
+            ProfileScope scope(Phase::SCHEDULE);
+            em_id = choose_next_proc();
+            ts = get_time_interval(em_id);
+        }
+        emprocs[em_id].awake(ts, network, poller);
+        requeue(em_id);
         // printf("[emulator.hpp]em_id : %d\n", em_id);
         schedule_sent_packets(em_id);
+        update_stats(loop + 1);
 	}
+    Profiler::instance().stop_run();
+    update_stats(loop, true);
 
 }
 
+void Emulator::start_epoch_emulation(const StopCondition& stop) {
+    std::vector<em_id_t> members;
+    std::vector<long long> windows;
+    long long horizon;
+    long long loop = 0;
+    struct timespec start_time;
+
+    if (!network.attributes_senders() && emprocs[0].pid >= 0) {
+        Logger::print_string_safe("[ERROR] Epochs need a network attributing packets to senders!\n");
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    Profiler::instance().start_run();
+    while (!should_stop(stop, loop, start_time)) {
+        {
+            ProfileScope scope(Phase::SCHEDULE);
+            horizon = lookahead.epoch_horizon(proc_queue);
+
+            /* The lowest clock is at most the horizon, its process always
+               runs (if only for the minimum quantum) so that the epoch
+               is never empty */
+            members.clear();
+            windows.clear();
+            for (em_id_t em_id = 0; em_id < procs; ++em_id) {
+                if (stop.steps >= 0 && loop + (long long)members.size() >= stop.steps)
+                    break;
+                if (!proc_queue.contains(em_id) || (proc_queue.get_clock(em_id) >= horizon
+                                                    && em_id != proc_queue.top()))
+                    continue;
+                members.push_back(em_id);
+                windows.push_back(policy.quantum(
+                    std::min(horizon - proc_queue.get_clock(em_id), 
+                             policy.get_batch() * lookahead.get_max_window()),
+                    MIN_EPOCH_QUANTUM));
+            }
+        }
+        LOG(DEBUG, SCHED, "Epoch up to %lld with %d processes", horizon, (int)members.size());
+
+        awake_together(members, windows);
+        for (em_id_t em_id: members) {
+            requeue(em_id);
+            schedule_sent_packets(em_id);
+        }
+        loop += members.size();
+        update_stats(loop);
+    }
+    Profiler::instance().stop_run();
+    update_stats(loop, true);
+}
+
 void Emulator::kill_emulation() {
-    int wstatus;
+    std::vector<int> alive;
+    struct timespec start_time;
+    char buf[BUF_SIZE];
 
     Logger::print_string_safe("KILLING EMULATION\n");
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     for (auto& emproc: emprocs) {
-        kill(emproc.pid, SIGCONT);
-        kill(emproc.pid, SIGINT);
-        // kill(emproc.pid, SIGKILL);
-        printf("KILLING %d\n", emproc.pid);
-        if (waitpid(emproc.pid, &wstatus, 0) == -1) {
-            Logger::print_string_safe("WAITPID FAILED!\n");
+        if (emproc.cgroup)
+            emproc.cgroup->kill(); /* Whole process tree, frozen or not */
+        if (emproc.exited || emproc.pid < 0)
+            continue;
+        if (!emproc.cgroup) {
+            kill(emproc.pid, SIGCONT);
+            kill(emproc.pid, SIGINT);
         }
-        // kill(emproc.pid, SIGTERM);
+        printf("KILLING %d\n", emproc.pid);
+        alive.push_back(emproc.pid);
 	}
+    Launcher::reap(alive, KILL_GRACE_MS);
+
+    for (auto& emproc: emprocs) {
+        if (emproc.cgroup)
+            emproc.cgroup->wait_empty();
+        emproc.cgroup.reset();
+    }
+    cgroup_root.reset();
+    recorder.reset(); /* Flushes the schedule log */
+    pcap.reset();
+    stats_page.reset();
+
+    snprintf(buf, sizeof(buf), "Teardown of %d processes took %.3f ms\n", 
+        (int)alive.size(), (double)nano_from_ts(get_time_since(start_time)) / MILLISECOND);
+    Logger::print_string_safe(buf);
 	Logger::print_string_safe("EMULATION KILLED\n");
 }
 
-void Emulator::fork_stop_run(int* pids, const ConfigParser& cp) {
-    int status;
+void Emulator::spawn_stopped(int* pids, const ConfigParser& cp, const Launcher& launcher) {
+    for (int i = 0; i < procs; ++i) {
+        network.enter_namespace(i);
+        pids[i] = launcher.spawn_stopped(cp.program_paths[i], cp.program_args[i]);
+    }
+    network.enter_namespace(-1);
 
     for (int i = 0; i < procs; ++i) {
-		status = fork();
-
-		if (status == -1) {
-            Logger::print_string_safe("[ERROR] Forking error!");
-			exit(1);
-		}
-		else if (status == 0) { /* This is a child process */
-			child_init(
-                cp.program_paths[i],
-                // cp.program_names[i],
-                cp.program_args[i]);
-		}
-		else { /* This is a parent process, new_id is set to child's pid */
-			pids[i] = status;
-		}
-	}
+        if (!Launcher::wait_stopped(pids[i])) {
+            Logger::print_string_safe("[ERROR] Process exited before it was scheduled!\n");
+            exit(1);
+        }
+    }
 }
 
-const char* Emulator::extractProgramName(const char* filePath) {
-    const char* fileName = std::strrchr(filePath, '/');
+void Emulator::place_in_cgroups() {
+    std::string parent = Cgroup::self_path();
 
-    // If '/' is found, move one character ahead to get the file name
-    if (fileName != nullptr) {
-        return fileName + 1;
+    if (parent.empty()) {
+        Logger::print_string_safe("[WARNING] cgroup v2 not mounted, stopping processes with signals\n");
+        return;
     }
+    cgroup_root.reset(new Cgroup(parent + "/tinyem." + std::to_string(getpid())));
 
-    // If '/' is not found, the entire path is the file name
-    return filePath;
+    for (auto& emproc: emprocs) {
+        /* Already stopped by itself, before exec */
+        emproc.cgroup.reset(new Cgroup(cgroup_root->get_path() + "/node" + std::to_string(emproc.em_id)));
+        emproc.cgroup->add(emproc.pid);
+        emproc.cgroup->freeze();
+        kill(emproc.pid, SIGCONT); /* Runs once the cgroup is thawed */
+    }
+    LOG(INFO, SCHED, "Processes placed in cgroups below %s", cgroup_root->get_path().c_str());
 }
 
-void Emulator::executeProgram(const std::string& program_path, const std::vector<std::string>& program_args) {
-    std::ostringstream cmd;
-    cmd << program_path;
-
-    for (const auto& arg : program_args) {
-        cmd << ' ' << arg;
+void Emulator::awake_together(const std::vector<em_id_t>& members, 
+                              const std::vector<long long>& windows) {
+    std::vector<em_id_t> running;
+    struct timespec quantum_deadline, delivery_deadline, deadline;
+    bool delivery;
+
+    for (size_t i = 0; i < members.size(); ++i) {
+        if (emprocs[members[i]].pid < 0)
+            emprocs[members[i]].awake(ts_from_nano(windows[i]), network, poller);
+        else if (emprocs[members[i]].begin_awake(ts_from_nano(windows[i])))
+            running.push_back(members[i]);
     }
+    if (running.empty())
+        return; /* No process to read packets of */
+
+    while (!running.empty()) {
+        /* Stop members whose quantum ran out, deliver to the others */
+        for (size_t i = 0; i < running.size(); ) {
+            EMProc& emproc = emprocs[running[i]];
+            emproc.update_elapsed();
+            if (emproc.quantum_over()) {
+                emproc.end_awake();
+                running[i] = running.back();
+                running.pop_back();
+                continue;
+            }
+            emproc.deliver_due(network);
+            ++i;
+        }
+        {
+            ProfileScope scope(Phase::TUN_WRITE);
+            network.flush();
+        }
+        if (receive_attributed() > 0 || running.empty())
+            continue;
 
-    int result = system(cmd.str().c_str());
-    if (result == 0) {
-        // The command executed successfully
-    } else {
-        // The command failed
+        /* Nothing received, sleep until something happens */
+        quantum_deadline = emprocs[running[0]].get_quantum_deadline();
+        delivery = false;
+        for (em_id_t em_id: running) {
+            quantum_deadline = std::min(quantum_deadline, emprocs[em_id].get_quantum_deadline());
+            if (!emprocs[em_id].get_delivery_deadline(deadline))
+                continue;
+            if (!delivery || deadline < delivery_deadline)
+                delivery_deadline = deadline;
+            delivery = true;
+        }
+        poller.arm_quantum(quantum_deadline);
+        if (delivery)
+            poller.arm_delivery(delivery_deadline);
+        else
+            poller.disarm_delivery();
+        ProfileScope scope(Phase::WAIT);
+        poller.wait();
     }
+
+    /* Sent right before the senders were stopped */
+    while (receive_attributed() > 0);
 }
 
-void Emulator::child_init(const std::string& program_path, const std::vector<std::string>& program_args) {
-    int status;
-    // Dynamically allocate memory for program_argv
-    char** program_argv = new char*[program_args.size() + 2];
-
-    program_argv[0] = const_cast<char*>(program_path.c_str());
-    // Logger::print_string_safe(program_path + " ");
-    for (size_t i = 0; i < program_args.size(); ++i) {
-        // Convert each string to a non-const char*
-        program_argv[i + 1] = const_cast<char*>(program_args[i].c_str());
-        // Logger::print_string_safe(program_args[i] + " ");
-    }
-    program_argv[program_args.size() + 1] = nullptr;
-    // Logger::print_string_safe("\n");
+int Emulator::receive_attributed() {
+    int received;
+    ssize_t ssize;
 
-    std::ifstream file(program_path);
-    if (program_path == "java") {
-        try
-        {
-            executeProgram(program_path, program_args);
-        }
-        catch(const std::exception& e)
+    for (received = 0; received < RECEIVE_BATCH; ++received) {
+        Packet packet({0, 0});
         {
-            std::cerr << e.what() << '\n';
+            ProfileScope scope(Phase::TUN_READ);
+            ssize = network.receive(packet);
         }
-        
-        delete[] program_argv; // Free the allocated memory after execve 
-        return;
+        if (ssize <= 0)
+            break;
+
+        em_id_t src_em_id = packet.get_version() == 4 ? 
+            network.get_em_id(packet.get_source_in_addr()) : -1;
+        if (src_em_id < 0)
+            continue; /* Not sent by an emulated process */
+        packet.increase_ts(emprocs[src_em_id].get_virtual_time());
+        emprocs[src_em_id].take_sent(std::move(packet), network);
     }
+    return received;
+}
 
-    if (!file.good()) {
-        char buf[] = "[WARNING] File does not exist: ";
-        strcat(buf, program_path.c_str());
-        strcat(buf, "\n");
-        Logger::print_string_safe(buf);
-    }
+em_id_t Emulator::choose_next_proc() const {
+    return proc_queue.top();
+}
 
-    if ((status = raise(SIGSTOP)) != 0) {
-        Logger::print_string_safe("[ERROR] raise(SIGSTOP) failed!\n");
-        perror("");
-        delete[] program_argv; // Free the allocated memory before returning
-        return;
-    }
+struct timespec Emulator::get_time_interval(em_id_t em_id) {
+    return ts_from_nano(policy.quantum(
+        lookahead.safe_window(em_id, proc_queue, policy.get_batch())));
+}
 
-    if ((status = execve(program_path.c_str(), program_argv, nullptr)) == -1) {
-        Logger::print_string_safe("[ERROR] execve() failed!\n");
-        perror("");
-        delete[] program_argv; // Free the allocated memory before returning
-        return;
-    }
+void Emulator::record_schedule(const std::string& path) {
+    recorder.reset(new ScheduleRecorder(path, procs));
+}
 
-    delete[] program_argv; // Free the allocated memory after execve 
+void Emulator::replay_schedule(const std::string& path) {
+    replayer.reset(new ScheduleReplayer(path, procs));
 }
 
-em_id_t Emulator::choose_next_proc() const {
-    em_id_t earliest_emproc = 0;
-    for (em_id_t em_id = 1; em_id < procs; ++em_id) {
-        if (emprocs[em_id].virtual_clock < emprocs[earliest_emproc].virtual_clock)
-            earliest_emproc = em_id;
-    }
-    return earliest_emproc;
+void Emulator::capture_packets(const std::string& path) {
+    pcap.reset(new PcapCapture(path, network));
 }
 
-struct timespec Emulator::get_time_interval(em_id_t em_id) const {
-    struct timespec result_ts = 2 * network.get_max_latency();
+void Emulator::publish_stats(const std::string& name) {
+    stats_page.reset(new StatsPage(name, procs));
+}
 
-    for (em_id_t other_proc = 0; other_proc < procs; ++other_proc) {
-        if (other_proc == em_id)
-            continue;
-        result_ts = std::min(result_ts, emprocs[other_proc].virtual_clock - 
-            emprocs[em_id].virtual_clock + network.get_latency(other_proc, em_id));
+void Emulator::print_stats() const {
+    policy.print_stats();
+    links.print_stats();
+    if (recorder)
+        recorder->print_stats();
+    if (replayer)
+        replayer->print_stats();
+    if (pcap)
+        pcap->print_stats();
+}
+
+bool Emulator::should_stop(const StopCondition& stop, long long loop, 
+                           struct timespec start_time) const {
+    if (proc_queue.empty())
+        return true;
+    if (stop.steps >= 0 && loop >= stop.steps)
+        return true;
+    if (stop.horizon >= 0 && proc_queue.get_clock(proc_queue.top()) >= stop.horizon)
+        return true;
+    if (stop.wall_budget >= 0 && nano_from_ts(get_time_since(start_time)) >= stop.wall_budget)
+        return true;
+    return false;
+}
+
+void Emulator::requeue(em_id_t em_id) {
+    ProfileScope scope(Phase::SCHEDULE);
+
+    if (emprocs[em_id].exited) {
+        proc_queue.erase(em_id);
+        LOG(INFO, SCHED, "Process %d removed from scheduling", em_id);
+        return;
     }
-    return result_ts;
+    proc_queue.update(em_id, nano_from_ts(emprocs[em_id].virtual_clock));
 }
 
 void Emulator::schedule_sent_packets(em_id_t em_id) {
+    ProfileScope scope(Phase::ROUTE);
+
     while(!emprocs[em_id].out_packets.empty()) {
-        Packet packet = emprocs[em_id].out_packets.top();
+        Packet packet = emprocs[em_id].out_packets.pop();
 
         // printf("[emulator.hpp] Out_packets: ------- em_id: %d\n", em_id);
 
-        emprocs[em_id].out_packets.pop();
-
-        if (packet.get_version() != 4)
+        if (packet.get_version() != 4) {
+            emprocs[em_id].stats.foreign++;
             continue; // FIXME temporary fix of random packets
+        }
 
-        em_id_t dest_em_id = network.get_em_id(packet.get_dest_addr());
-        packet.increase_ts(network.get_latency(em_id, dest_em_id));
+        em_id_t dest_em_id = network.get_em_id(packet.get_dest_in_addr());
+        if (emprocs[dest_em_id].exited) {
+            emprocs[em_id].stats.dropped++;
+            continue; /* Nobody to receive it */
+        }
+        long long send_ts = nano_from_ts(packet.get_ts());
+        long long latency = nano_from_ts(network.get_latency(em_id, dest_em_id));
+        long long link_delay = links.transmit(em_id, dest_em_id, send_ts, packet.get_size());
+        long long delivery_ts = link_delay < 0 ? -1 : send_ts + link_delay + latency;
+        if (replayer)
+            delivery_ts = replayer->delivery(send_ts, em_id, dest_em_id, 
+                                             packet.get_size(), latency, delivery_ts);
+        if (recorder)
+            recorder->record(send_ts, em_id, dest_em_id, packet.get_size(), delivery_ts);
+        if (pcap) {
+            /* Source first, so the capture shows sender and receiver */
+            {
+                ProfileScope rewrite_scope(Phase::REWRITE);
+                packet.rewrite_addrs(network.get_in_addr(em_id), packet.get_dest_in_addr());
+            }
+            pcap->capture(packet, em_id, dest_em_id, send_ts, delivery_ts);
+        }
+        if (delivery_ts < 0) {
+            emprocs[em_id].stats.dropped++;
+            continue; /* Dropped, link queue full */
+        }
+        packet.increase_ts(ts_from_nano(delivery_ts - send_ts));
+        policy.record_delivery(nano_from_ts(packet.get_ts()), 
+                               nano_from_ts(emprocs[dest_em_id].virtual_clock));
 
         // packet.set_dest_addr(network.get_inter_addr());
         // packet.set_source_addr(network.get_addr(em_id));
@@ -345,17 +698,30 @@ void Emulator::schedule_sent_packets(em_id_t em_id) {
         // std::cout << "packet size  :" << packet.get_size() << std::endl;
         // std::cout << "packet buffer:" << packet.get_buffer() << std::endl;
         // std::cout << "Emulator here" << std::endl;
-        packet.set_dest_addr_tcp(network.get_inter_addr());
-        packet.set_source_addr_tcp(network.get_addr(em_id));
-
-        packet.set_dest_addr_tcp(network.get_inter_addr());
-        packet.set_source_addr_tcp(network.get_addr(em_id));
+        {
+            ProfileScope rewrite_scope(Phase::REWRITE);
+            packet.rewrite_addrs(network.get_in_addr(em_id), network.get_delivery_in_addr(dest_em_id));
+        }
 
     // printf("[emulator.hpp] packet MODIFIED: %s (%d) -> %s (%d)\n", packet.get_source_addr().c_str(), em_id, packet.get_dest_addr().c_str(), dest_em_id); 
     // dump(packet.get_buffer(), packet.get_size());
 
-        logger_ptr->print_string_safe(packet.get_buffer());
-
-        emprocs[dest_em_id].in_packets.push(packet);
+        emprocs[dest_em_id].in_packets.push(std::move(packet));
     }
 }
+
+void Emulator::update_stats(long long steps, bool finished) {
+    if (!stats_page || !(finished || stats_page->due()))
+        return;
+
+    stats_page->begin();
+    for (auto& emproc: emprocs) {
+        ProcStats& stats = stats_page->proc(emproc.em_id);
+        stats = emproc.stats;
+        stats.virtual_clock = nano_from_ts(emproc.virtual_clock);
+        stats.in_queue = emproc.in_packets.size();
+        stats.out_queue = emproc.out_packets.size();
+        stats.exited = emproc.exited;
+    }
+    stats_page->end(steps, finished);
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "utils.hpp"
+
+#define EVENT_LOG_MAGIC "TINYEMLG" ///< First 8 bytes of a binary event log
+#define EVENT_LOG_VERSION 1 ///< Version of binary event log layout
+
+/** @brief Events logged in binary form on hot paths
+ *
+ * The format of each is in @ref LOG_EVENT_FORMATS, with its arguments
+ * stored in @ref LogRecord::args. New events are appended at the end,
+ * so old logs keep their meaning.
+ */
+enum class LogEvent : uint16_t {
+    PACKET_SENT,      ///< Running process sent a packet (em_id, dest em_id, length)
+    PACKET_DELIVERED, ///< Packet handed to TUN for a process (em_id, virtual time)
+    TUN_SEND,         ///< Packet written to TUN (source, source port, dest, dest port)
+    LOG_DROPPED,      ///< Written last for every thread (thread, records dropped)
+    COUNT             ///< Number of events
+};
+
+/** @brief Formats of @ref LogEvent, `%d` is an integer argument and `%a`
+ *         an IPv4 address (network byte order)
+ */
+static const char* const LOG_EVENT_FORMATS[] = {
+    "Process %d sending packet to process %d, packet length: %d",
+    "Process %d delivered packet at proc time: %d",
+    "Packet send from %a.%d to %a.%d",
+    "Thread %d dropped %d log records (ring full)",
+};
+
+static_assert(sizeof(LOG_EVENT_FORMATS) / sizeof(LOG_EVENT_FORMATS[0]) == (size_t)LogEvent::COUNT,
+              "every LogEvent needs a format");
+
+/** @brief Header of a binary event log, followed by @ref LogRecord s */
+struct EventLogHeader {
+    char magic[8]; ///< EVENT_LOG_MAGIC, without NUL
+    uint32_t version; ///< EVENT_LOG_VERSION
+    uint32_t record_size; ///< sizeof(LogRecord)
+};
+
+/** @brief Single binary log record */
+struct LogRecord {
+    int64_t ts; ///< CLOCK_MONOTONIC time of the event (ns)
+    uint16_t event; ///< @ref LogEvent
+    uint16_t thread; ///< Logging thread, in order of their first events
+    uint32_t reserved; ///< Padding, 0
+    int64_t args[4]; ///< Arguments of the event, unused are 0
+};
+
+/** @brief Renders @p record as text (without time)
+ *
+ * @param buf Buffer to write to
+ * @param size Size of the buffer
+ * @param record Record to render
+ * @return Number of characters written
+ */
+size_t format_log_record(char* buf, size_t size, const LogRecord& record) {
+    size_t offset = 0;
+    int arg = 0;
+
+    if (record.event >= (uint16_t)LogEvent::COUNT)
+        return snprintf(buf, size, "Unknown event %d", record.event);
+
+    for (const char* c = LOG_EVENT_FORMATS[record.event]; *c && offset + 1 < size; ++c) {
+        int written = 0;
+
+        if (c[0] == '%' && (c[1] == 'd' || c[1] == 'a') && arg < 4) {
+            if (c[1] == 'd') {
+                written = snprintf(buf + offset, size - offset, "%lld", (long long)record.args[arg++]);
+            }
+            else {
+                struct in_addr addr = {(in_addr_t)record.args[arg++]};
+                char text[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &addr, text, sizeof(text));
+                written = snprintf(buf + offset, size - offset, "%s", text);
+            }
+            ++c;
+        }
+        else {
+            buf[offset] = *c;
+            written = 1;
+        }
+        offset = std::min(offset + written, size - 1);
+    }
+    buf[offset] = '\0';
+    return offset;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+/* Levels of log messages, in increasing importance */
+#define LOG_LEVEL_TRACE 0 ///< Per packet events
+#define LOG_LEVEL_DEBUG 1 ///< Per awakening or epoch events
+#define LOG_LEVEL_INFO 2 ///< Setup, statistics, process exits
+#define LOG_LEVEL_OFF 3 ///< Nothing is logged
+
+/* Categories of log messages (bits of TINYEM_LOG_CATEGORIES) */
+#define LOG_CAT_SCHED 0x1 ///< Scheduling of processes
+#define LOG_CAT_PACKET 0x2 ///< Packets sent and delivered by processes
+#define LOG_CAT_NETWORK 0x4 ///< TUN and link model
+#define LOG_CAT_ALL 0x7
+
+/* Lowest level compiled in, lower sites compile to nothing
+ * (set by CMake to INFO for release builds) */
+#ifndef TINYEM_LOG_LEVEL
+#define TINYEM_LOG_LEVEL LOG_LEVEL_TRACE
+#endif
+
+/* Categories compiled in, others compile to nothing */
+#ifndef TINYEM_LOG_CATEGORIES
+#define TINYEM_LOG_CATEGORIES LOG_CAT_ALL
+#endif
+
+/** @brief Whether messages of @p level and @p category are compiled in
+ *
+ * Constant expression, so disabled sites including their arguments
+ * are removed by the compiler.
+ */
+#define LOG_COMPILED(level, category) \
+    (LOG_LEVEL_##level >= TINYEM_LOG_LEVEL && (TINYEM_LOG_CATEGORIES & LOG_CAT_##category) != 0)
+
+/** @brief Whether messages of @p level should be logged right now
+ *
+ * Runtime check of compiled-in sites, hinted as taken.
+ */
+#define LOG_ENABLED(level, category) \
+    (LOG_COMPILED(level, category) && __builtin_expect(logger_ptr->is_enabled(LOG_LEVEL_##level), 1))
+
+/** @brief Log formatted text (arguments of Logger::log_event) at
+ *         @p level in @p category, e.g. LOG(INFO, SCHED, "%d", x)
+ */
+#define LOG(level, category, ...) \
+    do { \
+        if (LOG_ENABLED(level, category)) \
+            logger_ptr->log_event(__VA_ARGS__); \
+    } while (0)
+
+/** @brief Log binary record (arguments of Logger::log) at @p level in
+ *         @p category, e.g. LOG_RECORD(TRACE, PACKET, LogEvent::PACKET_SENT, ...)
+ */
+#define LOG_RECORD(level, category, ...) \
+    do { \
+        if (LOG_ENABLED(level, category)) \
+            logger_ptr->log(__VA_ARGS__); \
+    } while (0)
@@ -5,29 +5,131 @@
 #include <stdarg.h>
 #include <time.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
 
 #include "utils.hpp"
+#include "log_events.hpp"
+#include "log_levels.hpp"
+
+/** @brief Single-producer, single-consumer ring of binary log records
+ *
+ * Owned by the @ref Logger, written by one logging thread and drained
+ * by the flusher. Full ring drops records instead of blocking.
+ */
+class EventRing {
+
+public:
+
+    static const size_t CAPACITY = 1 << 16; ///< Records per ring, power of 2
+
+    /** @brief Creates empty ring of thread @p thread */
+    EventRing(uint16_t thread);
+
+    /** @brief Appends record, or counts it as dropped if ring is full
+     *
+     * @param record Record to append (thread is filled in)
+     */
+    void push(LogRecord record);
+
+    /** @brief Writes available records to @p fd (flusher only)
+     *
+     * Partial writes are resumed, so records are always written whole.
+     * Records which could not be written are counted as dropped.
+     *
+     * @param fd File to write to
+     * @return Number of records written
+     */
+    size_t drain(int fd);
+
+    uint16_t get_thread() const;
+    unsigned long long get_dropped() const;
+
+private:
+
+    std::vector<LogRecord> records; ///< Ring storage
+    uint16_t thread; ///< Thread writing to the ring
+    std::atomic<size_t> head; ///< Records pushed so far
+    std::atomic<size_t> tail; ///< Records drained so far
+    std::atomic<unsigned long long> dropped; ///< Records dropped at full ring, or not written
+    bool write_failed; ///< Whether a write failed (reported only once)
+
+};
 
 /** @brief Utility class for logging in the system
  * 
  * Logger is used by the emulator for logging all recorded events in 
  * a structured manner. 
+ *
+ * Rare events are formatted into the text log right away. Hot paths 
+ * log @ref LogEvent s with @ref log instead: every thread copies a 
+ * binary record into its own @ref EventRing, and a background thread 
+ * writes the rings to the binary event log (rendered by tinyem-log).
+ * Nothing is formatted and no lock is taken on the logging thread.
+ *
+ * Call sites go through the LOG and LOG_RECORD macros, which drop 
+ * sites below TINYEM_LOG_LEVEL at compile time and check @ref level 
+ * on the rest.
  */
 class Logger {
 
+    static const long IDLE_SLEEP_NS = MILLISECOND; ///< Flusher's sleep when rings are empty
+
     FILE* file_ptr; ///< Pointer to FILE object to which to write
+    int events_fd; ///< Binary event log (-1 if events go to the text log)
+    unsigned id; ///< Distinguishes loggers in thread-local ring caches
+    int level; ///< Lowest LOG_LEVEL_* logged at runtime
+    std::mutex rings_lock; ///< Guards @ref rings
+    std::vector<std::unique_ptr<EventRing>> rings; ///< Ring of every logging thread
+    std::atomic<bool> stopping; ///< Set when flusher should drain and exit
+    std::atomic<unsigned long long> written; ///< Records written by the flusher
+    std::thread flusher; ///< Background thread writing rings to events_fd
 
 public:
 
     /** @brief Initializes logger and opens specified file
      * 
      * @param file_path Path to file to which to log to
+     * @param events_path Path of binary event log, if empty events are
+     *        formatted into the text log synchronously
      */
-    Logger(const std::string& file_path);
+    Logger(const std::string& file_path, const std::string& events_path = "");
     ~Logger();
 
+    /** @brief Log @p event with its arguments (lock-free, no formatting)
+     * 
+     * @param event Event to be logged
+     * @param arg0..arg3 Arguments of the event's format
+     */
+    void log(LogEvent event, long long arg0 = 0, long long arg1 = 0, 
+             long long arg2 = 0, long long arg3 = 0);
+
+    /** @brief Set lowest level logged at runtime
+     * 
+     * @param level One of LOG_LEVEL_*
+     */
+    void set_level(int level);
+
+    /** @brief Check whether messages of @p level are logged at runtime
+     * 
+     * @param level One of LOG_LEVEL_*
+     */
+    bool is_enabled(int level) const;
+
+    /** @brief Prints number of binary records written and dropped
+     */
+    void print_stats();
+
     /** @brief Log specified formatted string (printf style) with time of given clock
      * 
      * @param clock_type Type of clock which will be used to log
@@ -102,6 +204,18 @@ public:
 
 private:
 
+    /** @brief Get CLOCK_MONOTONIC time in nanoseconds
+     */
+    static long long now_ns();
+
+    /** @brief Get ring of the calling thread, registering it on first use
+     */
+    EventRing* thread_ring();
+
+    /** @brief Main loop of the flusher thread
+     */
+    void flush_events();
+
     /** @brief Appends time to logging file (without adding endline after)
      * 
      * @param clock_type Clock to be used
@@ -113,14 +227,157 @@ private:
 extern Logger* logger_ptr; ///< Pointer to global logger object
 
 
-Logger::Logger(const std::string& file_path) {
+EventRing::EventRing(uint16_t thread): records(CAPACITY), thread(thread), 
+        head(0), tail(0), dropped(0), write_failed(false) {}
+
+void EventRing::push(LogRecord record) {
+    size_t pos = head.load(std::memory_order_relaxed);
+
+    if (pos - tail.load(std::memory_order_acquire) >= CAPACITY) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    record.thread = thread;
+    records[pos & (CAPACITY - 1)] = record;
+    head.store(pos + 1, std::memory_order_release);
+}
+
+size_t EventRing::drain(int fd) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    size_t end = head.load(std::memory_order_acquire);
+    size_t total = end - pos;
+
+    while (pos != end) {
+        /* Up to the end of the ring at once */
+        size_t count = std::min(end - pos, CAPACITY - (pos & (CAPACITY - 1)));
+        const char* data = (const char*)&records[pos & (CAPACITY - 1)];
+        size_t left = count * sizeof(LogRecord);
+
+        while (left > 0) {
+            ssize_t written = write(fd, data, left);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0) {
+                /* Skip the rest, don't block the producer. A partly
+                   written record is cut off, so later ones stay aligned */
+                size_t done = count * sizeof(LogRecord) - left;
+                off_t partial = done % sizeof(LogRecord);
+                if (partial > 0)
+                    ftruncate(fd, lseek(fd, -partial, SEEK_CUR));
+
+                if (!write_failed)
+                    perror("Event log write");
+                write_failed = true;
+                size_t lost = end - pos - done / sizeof(LogRecord);
+                dropped.fetch_add(lost, std::memory_order_relaxed);
+                tail.store(end, std::memory_order_release);
+                return total - lost;
+            }
+            data += written;
+            left -= written;
+        }
+        pos += count;
+        tail.store(pos, std::memory_order_release);
+    }
+    return total;
+}
+
+uint16_t EventRing::get_thread() const {
+    return thread;
+}
+
+unsigned long long EventRing::get_dropped() const {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+Logger::Logger(const std::string& file_path, const std::string& events_path): 
+        events_fd(-1), level(LOG_LEVEL_TRACE), stopping(false), written(0) {
+    static std::atomic<unsigned> loggers(0);
+
+    id = ++loggers;
     file_ptr = fopen(file_path.c_str(), "w");
+    if (events_path.empty())
+        return;
+
+    events_fd = open(events_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (events_fd < 0) {
+        perror(events_path.c_str());
+        return; /* Events go to the text log */
+    }
+
+    EventLogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic));
+    header.version = EVENT_LOG_VERSION;
+    header.record_size = sizeof(LogRecord);
+    if (write(events_fd, &header, sizeof(header)) < 0)
+        perror(events_path.c_str());
+
+    /* Signals are handled by the emulator's thread, the flusher inherits
+       a mask blocking all of them from its very start */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    flusher = std::thread(&Logger::flush_events, this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
 }
 
 Logger::~Logger() {
+    if (events_fd >= 0) {
+        stopping.store(true, std::memory_order_release);
+        flusher.join();
+
+        /* Drop counts, so the formatter can tell where the log has holes */
+        for (auto& ring: rings) {
+            LogRecord record = {0, (uint16_t)LogEvent::LOG_DROPPED, ring->get_thread(), 0,
+                                {ring->get_thread(), (int64_t)ring->get_dropped(), 0, 0}};
+            record.ts = now_ns();
+            if (write(events_fd, &record, sizeof(record)) < 0)
+                break;
+        }
+        close(events_fd);
+    }
     fclose(file_ptr);
 }
 
+void Logger::log(LogEvent event, long long arg0, long long arg1, long long arg2, long long arg3) {
+    LogRecord record = {0, (uint16_t)event, 0, 0, {arg0, arg1, arg2, arg3}};
+
+    if (events_fd < 0) {
+        char buf[BUF_SIZE];
+        format_log_record(buf, sizeof(buf), record);
+        log_event("%s", buf);
+        return;
+    }
+
+    record.ts = now_ns();
+    thread_ring()->push(record);
+}
+
+void Logger::set_level(int level) {
+    this->level = level;
+}
+
+bool Logger::is_enabled(int level) const {
+    return level >= this->level;
+}
+
+void Logger::print_stats() {
+    char buf[BUF_SIZE];
+    unsigned long long dropped = 0;
+
+    if (events_fd < 0)
+        return;
+
+    std::lock_guard<std::mutex> guard(rings_lock);
+    for (auto& ring: rings)
+        dropped += ring->get_dropped();
+    snprintf(buf, sizeof(buf), "Event log: %d threads, %llu records written, %llu dropped\n", 
+        (int)rings.size(), written.load(std::memory_order_relaxed), dropped);
+    print_string_safe(buf);
+    log_event("%s", buf);
+}
+
 void Logger::log_event(clockid_t clock_type, const char* format, va_list args) {
     log_time(clock_type);
     vfprintf(file_ptr, format, args);
@@ -145,6 +402,45 @@ void Logger::log_event(const char* format, ...) {
     va_end(args);
 }
 
+long long Logger::now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return nano_from_ts(now);
+}
+
+EventRing* Logger::thread_ring() {
+    static thread_local unsigned cached_id = 0;
+    static thread_local EventRing* cached_ring = nullptr;
+
+    if (cached_id == id)
+        return cached_ring;
+
+    std::lock_guard<std::mutex> guard(rings_lock);
+    rings.emplace_back(new EventRing(rings.size()));
+    cached_id = id;
+    cached_ring = rings.back().get();
+    return cached_ring;
+}
+
+void Logger::flush_events() {
+    while (true) {
+        bool stop = stopping.load(std::memory_order_acquire);
+        size_t drained = 0;
+
+        {
+            std::lock_guard<std::mutex> guard(rings_lock);
+            for (auto& ring: rings)
+                drained += ring->drain(events_fd);
+        }
+        written.fetch_add(drained, std::memory_order_relaxed);
+
+        if (stop)
+            return; /* Everything logged before stopping is written */
+        if (drained == 0)
+            real_sleep(IDLE_SLEEP_NS);
+    }
+}
+
 void Logger::log_time(clockid_t clock_type) {
     struct timespec res;
     clock_gettime(clock_type, &res);
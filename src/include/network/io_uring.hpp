@@ -0,0 +1,218 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <algorithm>
+
+#include "utils.hpp"
+
+/** @brief Minimal io_uring instance driven through raw syscalls
+ *
+ * Maps the submission and completion rings of a new io_uring and allows
+ * queueing submission entries, submitting them in one `io_uring_enter`
+ * call and reaping completions straight from shared memory. Reaping
+ * does not need a syscall. Number of `io_uring_enter` calls is counted
+ * for statistics.
+ */
+class IoUring {
+
+    int ring_fd; ///< FD of the io_uring instance (-1 if setup failed)
+    unsigned entries; ///< Number of submission queue entries
+
+    void* sq_ptr; ///< Mapping of the submission ring
+    void* cq_ptr; ///< Mapping of the completion ring (same as sq_ptr with single mmap)
+    size_t sq_len; ///< Length of sq_ptr mapping
+    size_t cq_len; ///< Length of cq_ptr mapping
+    struct io_uring_sqe* sqes; ///< Array of submission queue entries
+    size_t sqes_len; ///< Length of sqes mapping
+
+    unsigned* sq_head; ///< Submission ring head (advanced by kernel)
+    unsigned* sq_tail; ///< Submission ring tail (advanced by us)
+    unsigned* sq_mask; ///< Submission ring mask
+    unsigned* sq_array; ///< Submission ring indirection array
+    unsigned* cq_head; ///< Completion ring head (advanced by us)
+    unsigned* cq_tail; ///< Completion ring tail (advanced by kernel)
+    unsigned* cq_mask; ///< Completion ring mask
+    struct io_uring_cqe* cqes; ///< Array of completion queue entries
+
+    unsigned to_submit; ///< Entries queued since last submit
+    unsigned long long enter_calls; ///< Number of io_uring_enter syscalls made
+
+public:
+
+    /** @brief Sets up io_uring with @p entries submission entries
+     *
+     * On failure (e.g. kernel without io_uring) the object is left
+     * unusable, which can be checked with @ref ok.
+     *
+     * @param entries Size of the submission queue
+     */
+    IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /** @brief Check if the ring was set up successfully
+     *
+     * @return If the ring is usable
+     */
+    bool ok() const;
+
+    /** @brief Get FD of the ring, readable when completions are available
+     *
+     * @return io_uring FD
+     */
+    int get_fd() const;
+
+    /** @brief Get a free submission entry, cleared and ready to be filled
+     *
+     * @return Submission entry (nullptr if submission queue is full)
+     */
+    struct io_uring_sqe* get_sqe();
+
+    /** @brief Submit all queued entries in a single syscall
+     *
+     * @param wait_for Number of completions to wait for before returning
+     * @return Number of entries submitted
+     */
+    int submit(unsigned wait_for = 0);
+
+    /** @brief Calls @p handle for every available completion and consumes them
+     *
+     * @param handle Function called with (user_data, res) of every completion
+     * @return Number of reaped completions
+     */
+    template<typename Handler>
+    unsigned reap(Handler handle);
+
+    /** @brief Get number of io_uring_enter syscalls made so far
+     *
+     * @return Number of syscalls
+     */
+    unsigned long long get_enter_calls() const;
+
+};
+
+IoUring::IoUring(unsigned entries): ring_fd(-1), entries(entries),
+        sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sqes(nullptr),
+        to_submit(0), enter_calls(0) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0)
+        return;
+
+    sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sq_len = cq_len = std::max(sq_len, cq_len);
+
+    sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        cq_ptr = sq_ptr;
+    else
+        cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+
+    sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes_ptr = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+
+    if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes_ptr == MAP_FAILED) {
+        close(ring_fd);
+        ring_fd = -1;
+        return;
+    }
+    sqes = (struct io_uring_sqe*)sqes_ptr;
+
+    sq_head = (unsigned*)((char*)sq_ptr + params.sq_off.head);
+    sq_tail = (unsigned*)((char*)sq_ptr + params.sq_off.tail);
+    sq_mask = (unsigned*)((char*)sq_ptr + params.sq_off.ring_mask);
+    sq_array = (unsigned*)((char*)sq_ptr + params.sq_off.array);
+    cq_head = (unsigned*)((char*)cq_ptr + params.cq_off.head);
+    cq_tail = (unsigned*)((char*)cq_ptr + params.cq_off.tail);
+    cq_mask = (unsigned*)((char*)cq_ptr + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)((char*)cq_ptr + params.cq_off.cqes);
+    this->entries = params.sq_entries;
+}
+
+IoUring::~IoUring() {
+    if (sqes != nullptr)
+        munmap(sqes, sqes_len);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+        munmap(cq_ptr, cq_len);
+    if (sq_ptr != MAP_FAILED)
+        munmap(sq_ptr, sq_len);
+    if (ring_fd >= 0)
+        close(ring_fd);
+}
+
+bool IoUring::ok() const {
+    return ring_fd >= 0;
+}
+
+int IoUring::get_fd() const {
+    return ring_fd;
+}
+
+struct io_uring_sqe* IoUring::get_sqe() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail + to_submit;
+
+    if (tail - head >= entries)
+        return nullptr;
+
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    to_submit++;
+    return sqe;
+}
+
+int IoUring::submit(unsigned wait_for) {
+    unsigned submitting = to_submit;
+    int ret;
+
+    if (submitting == 0 && wait_for == 0)
+        return 0;
+
+    __atomic_store_n(sq_tail, *sq_tail + submitting, __ATOMIC_RELEASE);
+    to_submit = 0;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ring_fd, submitting, wait_for,
+            wait_for > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        enter_calls++;
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        panic("io_uring_enter");
+    return ret;
+}
+
+template<typename Handler>
+unsigned IoUring::reap(Handler handle) {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    unsigned reaped = 0;
+
+    for (; head != tail; ++head, ++reaped) {
+        const struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        handle(cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+unsigned long long IoUring::get_enter_calls() const {
+    return enter_calls;
+}
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+
+#include "utils.hpp"
+
+/** @brief Pairwise latencies of processes, stored as compactly as the
+ *         topology allows, each looked up in O(1)
+ *
+ * Three representations:
+ *  - dense: full procs x procs matrix,
+ *  - regions: region id of every process and a regions x regions
+ *    matrix, latency of two different processes is the latency between
+ *    their regions (diagonal - latency inside a region),
+ *  - edges: shortest paths over a sparse graph of links, computed when
+ *    the table is built and stored in milliseconds on 16 bits. A process
+ *    linked to a single neighbour (a leaf) reaches everything through
+ *    it, so it only keeps its hub and its distance to the hub. Rows of
+ *    paths (Dijkstra, O(m log n) each) are kept for hubs only, in a
+ *    hubs x hubs matrix, hubs being stored as regions.
+ *
+ * Edges mode limits: paths between hubs and links of leaves are at
+ * most 65535 ms (UINT16_MAX) and latencies have millisecond granularity.
+ * The matrix takes 2 * hubs^2 bytes, e.g. 200 MB for 10k processes none
+ * of which is a leaf.
+ *
+ * Latency of a process to itself is always 0.
+ *
+ * The table either owns its data, or is a view of arrays stored 
+ * elsewhere (a mapped binary config), which have to outlive it.
+ */
+class LatencyTable {
+
+public:
+
+    /** @brief Representation of the table */
+    enum class Mode { DENSE, REGIONS, EDGES };
+
+    /** @brief Link of the sparse graph, latency in milliseconds */
+    struct Edge {
+        int src; ///< One end of the link
+        int dest; ///< Other end of the link
+        int latency; ///< Latency of the link in milliseconds
+    };
+
+    LatencyTable();
+
+    LatencyTable(const LatencyTable&) = delete;
+    LatencyTable& operator=(const LatencyTable&) = delete;
+
+    /** @brief Builds dense table from row-major @p matrix
+     *
+     * @param procs Number of processes
+     * @param matrix Latencies in nanoseconds, procs * procs of them
+     * @return False if some latency is negative
+     */
+    bool set_dense(int procs, std::vector<int>&& matrix);
+
+    /** @brief Builds region table
+     *
+     * @param region_of Region id of every process
+     * @param regions Number of regions
+     * @param matrix Row-major latencies between regions in nanoseconds
+     * @return False if some latency is negative, or a region id is not
+     *         in [0, regions)
+     */
+    bool set_regions(std::vector<int>&& region_of, int regions, std::vector<int>&& matrix);
+
+    /** @brief Builds table of shortest paths over undirected @p edges
+     *
+     * @param procs Number of processes
+     * @param edges Links of the graph, latencies non-negative
+     * @return False if some processes are not connected or a path is
+     *         longer than the 16 bit representation allows
+     */
+    bool set_edges(int procs, const std::vector<Edge>& edges);
+
+    /** @brief Makes the table a view of arrays laid out as in @ref get_data
+     *
+     * The highest latency is recomputed from the arrays.
+     *
+     * @param mode Representation of the arrays
+     * @param procs Number of processes
+     * @param regions Number of regions (REGIONS mode) or hubs (EDGES mode)
+     * @param data Arrays of the representation, one after another
+     * @return False if the arrays are inconsistent (ids out of range,
+     *         negative latencies)
+     */
+    bool set_view(Mode mode, int procs, int regions, const void* data);
+
+    /** @brief Get size of arrays of the representation in bytes
+     *
+     * @return Size of data returned by @ref get_data
+     */
+    size_t get_data_size() const;
+
+    /** @brief Get size of arrays of a representation in bytes
+     *
+     * @param mode Representation of the arrays
+     * @param procs Number of processes
+     * @param regions Number of regions (REGIONS mode) or hubs (EDGES mode)
+     * @return Size of data laid out as in @ref get_data
+     */
+    static size_t data_size(Mode mode, int procs, int regions);
+
+    /** @brief Copies arrays of the representation to @p data
+     *
+     * DENSE: int matrix[procs * procs], REGIONS: int region_of[procs]
+     * followed by int matrix[regions * regions], EDGES: int 
+     * region_of[procs] (hub of every process), int offset[procs] 
+     * (distance to the hub in ms) and uint16_t paths[regions * regions].
+     *
+     * @param data Buffer of @ref get_data_size bytes
+     */
+    void get_data(void* data) const;
+
+    /** @brief Get latency from @p src to @p dest
+     *
+     * @param src Sending process
+     * @param dest Receiving process
+     * @return Latency in nanoseconds
+     */
+    long long get(int src, int dest) const;
+
+    /** @brief Get highest latency in the table
+     *
+     * @return Maximum pairwise latency in nanoseconds
+     */
+    long long get_max() const;
+
+    int get_procs() const;
+    int get_regions() const;
+    Mode get_mode() const;
+
+private:
+
+    Mode mode; ///< Representation in use
+    int procs; ///< Number of processes
+    int regions; ///< Number of regions (REGIONS mode) or hubs (EDGES mode)
+    std::vector<int> matrix; ///< Latencies (ns) of pairs of processes (DENSE) or regions (REGIONS)
+    std::vector<int> region_of; ///< Region (REGIONS) or hub (EDGES) of every process
+    std::vector<int> offset; ///< Distance to the hub in ms (EDGES)
+    std::vector<uint16_t> paths; ///< Shortest path latencies of hubs in ms (EDGES)
+    long long max_latency; ///< Highest latency in the table (ns)
+
+    const int* matrix_view; ///< Data of matrix, owned or not
+    const int* region_of_view; ///< Data of region_of, owned or not
+    const int* offset_view; ///< Data of offset, owned or not
+    const uint16_t* paths_view; ///< Data of paths, owned or not
+
+    /** @brief Checks arrays in use and computes @ref max_latency
+     *
+     * @return False if they are inconsistent (see @ref set_view)
+     */
+    bool validate();
+
+};
+
+LatencyTable::LatencyTable(): mode(Mode::DENSE), procs(0), regions(0),
+        max_latency(0), matrix_view(nullptr), region_of_view(nullptr), 
+        offset_view(nullptr), paths_view(nullptr) {}
+
+bool LatencyTable::set_dense(int procs, std::vector<int>&& matrix) {
+    this->mode = Mode::DENSE;
+    this->procs = procs;
+    this->matrix = std::move(matrix);
+    matrix_view = this->matrix.data();
+    return validate();
+}
+
+bool LatencyTable::set_regions(std::vector<int>&& region_of, int regions, std::vector<int>&& matrix) {
+    this->mode = Mode::REGIONS;
+    this->procs = region_of.size();
+    this->regions = regions;
+    this->region_of = std::move(region_of);
+    this->matrix = std::move(matrix);
+    region_of_view = this->region_of.data();
+    matrix_view = this->matrix.data();
+    return validate();
+}
+
+bool LatencyTable::set_edges(int procs, const std::vector<Edge>& edges) {
+    typedef std::pair<long long, int> Entry; ///< (distance, process)
+    std::vector<std::vector<std::pair<int, int>>> adjacent(procs);
+    std::vector<long long> distance(procs);
+    std::vector<int> hubs;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+
+    this->mode = Mode::EDGES;
+    this->procs = procs;
+    region_of.assign(procs, -1);
+    offset.assign(procs, 0);
+
+    for (const auto& edge: edges) {
+        if (edge.src == edge.dest)
+            continue;
+        adjacent[edge.src].push_back({edge.dest, edge.latency});
+        adjacent[edge.dest].push_back({edge.src, edge.latency});
+    }
+
+    /* A leaf hangs off its only neighbour, unless the neighbour is a
+       leaf itself (two processes linked only to each other) */
+    std::vector<int> hub_of(procs, -1);
+    for (int proc = 0; proc < procs; ++proc) {
+        if (hub_of[proc] >= 0)
+            continue; /* Already a hub of some leaf */
+        int neighbour = adjacent[proc].empty() ? -1 : adjacent[proc][0].first;
+        int link = INT_MAX;
+        for (const auto& next: adjacent[proc]) {
+            if (next.first != neighbour)
+                neighbour = -1;
+            link = std::min(link, next.second);
+        }
+        if (neighbour >= 0 && (hub_of[neighbour] < 0 || hub_of[neighbour] == neighbour) &&
+                link <= UINT16_MAX) {
+            hub_of[proc] = neighbour;
+            hub_of[neighbour] = neighbour;
+            offset[proc] = link;
+        }
+        else
+            hub_of[proc] = proc;
+    }
+    for (int proc = 0; proc < procs; ++proc) {
+        if (hub_of[proc] == proc) {
+            region_of[proc] = hubs.size();
+            hubs.push_back(proc);
+        }
+    }
+    for (int proc = 0; proc < procs; ++proc)
+        region_of[proc] = region_of[hub_of[proc]];
+
+    regions = hubs.size();
+    paths.assign((size_t)regions * regions, 0);
+    region_of_view = region_of.data();
+    offset_view = offset.data();
+    paths_view = paths.data();
+
+    for (int src: hubs) {
+        std::fill(distance.begin(), distance.end(), LLONG_MAX);
+        distance[src] = 0;
+        queue.push({0, src});
+
+        while (!queue.empty()) {
+            Entry top = queue.top();
+            queue.pop();
+            if (top.first > distance[top.second])
+                continue; /* Outdated entry */
+            for (const auto& next: adjacent[top.second]) {
+                if (top.first + next.second < distance[next.first]) {
+                    distance[next.first] = top.first + next.second;
+                    queue.push({distance[next.first], next.first});
+                }
+            }
+        }
+
+        for (int dest: hubs) {
+            if (distance[dest] > UINT16_MAX)
+                return false; /* Not connected, or too far */
+            paths[(size_t)region_of[src] * regions + region_of[dest]] = distance[dest];
+        }
+    }
+    return validate();
+}
+
+bool LatencyTable::set_view(Mode mode, int procs, int regions, const void* data) {
+    this->mode = mode;
+    this->procs = procs;
+    this->regions = regions;
+
+    switch (mode) {
+    case Mode::REGIONS:
+        region_of_view = (const int*)data;
+        matrix_view = region_of_view + procs;
+        break;
+    case Mode::EDGES:
+        region_of_view = (const int*)data;
+        offset_view = region_of_view + procs;
+        paths_view = (const uint16_t*)(offset_view + procs);
+        break;
+    default:
+        matrix_view = (const int*)data;
+        break;
+    }
+    return validate();
+}
+
+size_t LatencyTable::get_data_size() const {
+    return data_size(mode, procs, regions);
+}
+
+size_t LatencyTable::data_size(Mode mode, int procs, int regions) {
+    switch (mode) {
+    case Mode::REGIONS:
+        return ((size_t)procs + (size_t)regions * regions) * sizeof(int);
+    case Mode::EDGES:
+        return (size_t)procs * 2 * sizeof(int) + (size_t)regions * regions * sizeof(uint16_t);
+    default:
+        return (size_t)procs * procs * sizeof(int);
+    }
+}
+
+void LatencyTable::get_data(void* data) const {
+    switch (mode) {
+    case Mode::REGIONS:
+        memcpy(data, region_of_view, procs * sizeof(int));
+        memcpy((int*)data + procs, matrix_view, (size_t)regions * regions * sizeof(int));
+        break;
+    case Mode::EDGES:
+        memcpy(data, region_of_view, procs * sizeof(int));
+        memcpy((int*)data + procs, offset_view, procs * sizeof(int));
+        memcpy((int*)data + 2 * procs, paths_view, (size_t)regions * regions * sizeof(uint16_t));
+        break;
+    default:
+        memcpy(data, matrix_view, get_data_size());
+        break;
+    }
+}
+
+long long LatencyTable::get(int src, int dest) const {
+    switch (mode) {
+    case Mode::REGIONS:
+        if (src == dest)
+            return 0;
+        return matrix_view[region_of_view[src] * regions + region_of_view[dest]];
+    case Mode::EDGES:
+        if (src == dest)
+            return 0;
+        return ((long long)offset_view[src] + offset_view[dest] + 
+            paths_view[(size_t)region_of_view[src] * regions + region_of_view[dest]]) * MILLISECOND;
+    default:
+        return matrix_view[(size_t)src * procs + dest];
+    }
+}
+
+long long LatencyTable::get_max() const {
+    return max_latency;
+}
+
+int LatencyTable::get_procs() const {
+    return procs;
+}
+
+int LatencyTable::get_regions() const {
+    return regions;
+}
+
+LatencyTable::Mode LatencyTable::get_mode() const {
+    return mode;
+}
+
+bool LatencyTable::validate() {
+    max_latency = 0;
+
+    if (mode == Mode::DENSE) {
+        for (size_t i = 0; i < (size_t)procs * procs; ++i) {
+            if (matrix_view[i] < 0)
+                return false;
+            max_latency = std::max(max_latency, (long long)matrix_view[i]);
+        }
+        return true;
+    }
+
+    if (regions < 1 || regions > std::max(procs, 1))
+        return false;
+
+    /* Highest latency of a pair of regions is between their members
+       furthest from the hubs (all at 0 in REGIONS mode). Only pairs of 
+       regions that some processes are in count. */
+    long long unit = mode == Mode::EDGES ? MILLISECOND : 1;
+    std::vector<long long> furthest(regions, -1), second(regions, -1);
+    for (int proc = 0; proc < procs; ++proc) {
+        int region = region_of_view[proc];
+        long long distance = mode == Mode::EDGES ? offset_view[proc] * unit : 0;
+        if (region < 0 || region >= regions || distance < 0)
+            return false;
+        if (distance > furthest[region]) {
+            second[region] = furthest[region];
+            furthest[region] = distance;
+        }
+        else if (distance > second[region])
+            second[region] = distance;
+    }
+
+    for (int r1 = 0; r1 < regions; ++r1) {
+        for (int r2 = 0; r2 < regions; ++r2) {
+            size_t index = (size_t)r1 * regions + r2;
+            long long between = mode == Mode::EDGES ? 
+                paths_view[index] * unit : matrix_view[index];
+            if (between < 0)
+                return false;
+            long long other = r1 == r2 ? second[r1] : furthest[r2];
+            if (furthest[r1] < 0 || other < 0)
+                continue;
+            max_latency = std::max(max_latency, furthest[r1] + other + between);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <unordered_map>
+#include <algorithm>
+
+#include "utils.hpp"
+#include "logger.hpp"
+#include "config-parser.hpp"
+
+/** @brief Bandwidth and queueing model of directed links
+ *
+ * Every link with limited capacity is a FIFO queue in front of a
+ * transmitter of fixed bandwidth. Only the time the transmitter becomes
+ * free is kept per link: a packet entering at time t starts being sent
+ * at max(t, busy_until), and takes size / bandwidth to serialize. The
+ * queue backlog at t is (busy_until - t) * bandwidth bytes, so a packet
+ * not fitting into the queue is dropped (a packet finding the link idle
+ * is always sent) - all in O(1) per packet.
+ *
+ * Packets of a link have to enter it in non-decreasing time order, which
+ * holds as they come from a single sender, ordered by its clock.
+ * The model only delays packets, so it never breaks the lookahead.
+ *
+ * The capacity given for every link is kept once, links with their own
+ * capacity are kept in a hash map by (src, dest). A link using the
+ * common capacity gets its entry when it first carries a packet, so
+ * memory grows with links in use, not with procs * procs.
+ */
+class LinkModel {
+
+    /** @brief State of a single directed link */
+    struct Link {
+        long long bandwidth; ///< Bits per second (0 if unlimited)
+        long long queue; ///< Queue size in bytes
+        long long busy_until; ///< Time (ns) transmitter becomes free
+    };
+
+    Link common; ///< Capacity of links not in @ref links (bandwidth 0 if unlimited)
+    std::unordered_map<uint64_t, Link> links; ///< Links with own capacity, or which carried a packet
+
+    unsigned long long transmitted; ///< Packets which went through limited links
+    unsigned long long dropped; ///< Packets dropped at full queues
+    long long max_queueing; ///< Longest time (ns) a packet waited in a queue
+
+public:
+
+    /** @brief Sets link capacities from @p cp
+     *
+     * @param cp Configuration with link capacities
+     */
+    LinkModel(const ConfigParser& cp);
+
+    /** @brief Puts packet of @p size bytes sent at @p send_ts on the
+     *         link from @p src to @p dest
+     *
+     * @param src Sending process
+     * @param dest Receiving process
+     * @param send_ts Virtual time (ns) the packet was sent at
+     * @param size Size of the packet in bytes
+     * @return Queueing and serialization delay in nanoseconds,
+     *         -1 if the packet was dropped
+     */
+    long long transmit(int src, int dest, long long send_ts, size_t size);
+
+    /** @brief Print transmitted and dropped packets
+     */
+    void print_stats() const;
+
+private:
+
+    /** @brief Get key of the link from @p src to @p dest in @ref links */
+    static uint64_t key(int src, int dest);
+
+};
+
+LinkModel::LinkModel(const ConfigParser& cp): common{0, 0, 0}, transmitted(0),
+        dropped(0), max_queueing(0) {
+    for (const auto& capacity: cp.capacities) {
+        if (capacity.src < 0) /* Links without own line, given before or after */
+            common = {capacity.bandwidth, capacity.queue, 0};
+        else
+            links[key(capacity.src, capacity.dest)] = {capacity.bandwidth, capacity.queue, 0};
+    }
+}
+
+long long LinkModel::transmit(int src, int dest, long long send_ts, size_t size) {
+    if (common.bandwidth == 0 && links.empty())
+        return 0;
+
+    auto it = links.find(key(src, dest));
+    if (it == links.end()) {
+        if (common.bandwidth == 0)
+            return 0;
+        it = links.emplace(key(src, dest), common).first;
+    }
+
+    Link& link = it->second;
+    if (link.bandwidth == 0)
+        return 0;
+
+    long long start = std::max(send_ts, link.busy_until);
+    long long backlog = (double)(start - send_ts) * link.bandwidth / 8 / SECOND;
+    if (backlog > 0 && backlog + (long long)size > link.queue) {
+        dropped++;
+        return -1;
+    }
+
+    link.busy_until = start + (long long)size * 8 * SECOND / link.bandwidth;
+    transmitted++;
+    max_queueing = std::max(max_queueing, start - send_ts);
+    return link.busy_until - send_ts;
+}
+
+uint64_t LinkModel::key(int src, int dest) {
+    return (uint64_t)src << 32 | (uint32_t)dest;
+}
+
+void LinkModel::print_stats() const {
+    char buf[BUF_SIZE];
+
+    if (common.bandwidth == 0 && links.empty())
+        return;
+    snprintf(buf, sizeof(buf),
+        "Links: %llu packets transmitted, %llu dropped, max queueing delay %lld us\n",
+        transmitted, dropped, max_queueing / MICROSECOND);
+    Logger::print_string_safe(buf);
+    LOG(INFO, NETWORK, "%s", buf);
+}
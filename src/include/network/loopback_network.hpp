@@ -0,0 +1,181 @@
+#pragma once
+
+#include <sys/timerfd.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "utils.hpp"
+#include "logger.hpp"
+#include "config-parser.hpp"
+#include "network/packet.hpp"
+#include "network/packet_pool.hpp"
+#include "network/network.hpp"
+
+/** @brief Network backend generating synthetic packets in memory
+ *
+ * Instead of reading what the running process sent, every @ref receive
+ * generates an IPv4/TCP packet with @ref payload bytes of payload,
+ * addressed to a uniformly random process, at most @ref rate packets
+ * per second of real time (any number if rate is 0). Packets delivered
+ * with @ref send are counted and dropped. No kernel I/O is done per
+ * packet, so the scheduler and packet routing can be measured without
+ * root or a TUN interface.
+ *
+ * @ref get_fd is a timerfd armed for the next packet when the rate
+ * limit was hit, so the awakening loop sleeps until then.
+ *
+ * Processes are still spawned and stopped for the generated traffic,
+ * unless the emulation has nodes without processes (see
+ * @ref EMProc::generate): those read a packet whenever they send one,
+ * by their virtual clocks, from a generator without rate limit.
+ */
+class LoopbackNetwork : public Network {
+
+    long long rate; ///< Packets generated per second (0 if unlimited)
+    size_t payload; ///< Payload of generated packets (bytes)
+    size_t frame_size; ///< Size of generated packets (bytes)
+    char frame[PacketPool::SLOT_SIZE]; ///< Template of generated packets
+    int timer_fd; ///< Readable when next packet may be generated
+    long long next_ns; ///< CLOCK_MONOTONIC time of next packet (ns)
+    uint64_t seed; ///< State of the destination generator (xorshift)
+    unsigned long long bytes_received; ///< Bytes of generated packets
+    unsigned long long bytes_sent; ///< Bytes of delivered packets
+
+public:
+
+    /** @brief Creates generator of packets among processes of @p cp
+     *
+     * @param cp Emulator's configuration read from a file
+     * @param rate Packets generated per second (0 if unlimited)
+     * @param payload Payload of generated packets (bytes, at most MTU
+     *        without headers)
+     */
+    LoopbackNetwork(const ConfigParser& cp, long long rate, size_t payload = 64);
+    ~LoopbackNetwork();
+
+    /** @brief Get FD to poll for incoming packets
+     *
+     * @return timerfd armed for the next packet
+     */
+    int get_fd() const override;
+
+    /** @brief Drops @p packet, counting it as delivered
+     *
+     * @param packet Packet which will be sent (consumed)
+     */
+    void send(Packet&& packet) override;
+
+    /** @brief Does nothing, every send is done at once
+     */
+    void flush() override;
+
+    /** @brief Generates packet to a random process, unless rate limit is hit
+     *
+     * @param packet Empty packet whose buffer will hold generated data
+     * @return Size of generated packet (-1 with EAGAIN if rate limit is hit)
+     */
+    ssize_t receive(Packet& packet) override;
+
+    /** @brief Print and log counters of generated and delivered packets
+     */
+    void print_stats() const override;
+
+private:
+
+    /** @brief Get next random process (xorshift64) */
+    int next_dest();
+
+};
+
+LoopbackNetwork::LoopbackNetwork(const ConfigParser& cp, long long rate, size_t payload):
+        Network(cp), rate(rate), next_ns(0), seed(0x9E3779B97F4A7C15ULL),
+        bytes_received(0), bytes_sent(0) {
+    struct iphdr* ip = (struct iphdr*)frame;
+    struct tcphdr* tcp = (struct tcphdr*)(ip + 1);
+
+    this->payload = std::min(payload, (size_t)MTU - sizeof(*ip) - sizeof(*tcp));
+    frame_size = sizeof(*ip) + sizeof(*tcp) + this->payload;
+
+    memset(frame, 0, sizeof(frame));
+    ip->version = 4;
+    ip->ihl = 5;
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_TCP;
+    ip->tot_len = htons(frame_size);
+    ip->saddr = get_inter_in_addr();
+    tcp->th_sport = htons(1024);
+    tcp->th_dport = htons(1024);
+    tcp->th_off = 5;
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0)
+        panic("timerfd_create");
+}
+
+LoopbackNetwork::~LoopbackNetwork() {
+    close(timer_fd);
+}
+
+int LoopbackNetwork::get_fd() const {
+    return timer_fd;
+}
+
+void LoopbackNetwork::send(Packet&& packet) {
+    Packet delivered(std::move(packet)); /* Slot goes back to the pool */
+
+    packets_sent++;
+    bytes_sent += delivered.get_size();
+}
+
+void LoopbackNetwork::flush() {}
+
+ssize_t LoopbackNetwork::receive(Packet& packet) {
+    if (rate > 0) {
+        struct timespec now_ts;
+        clock_gettime(CLOCK_MONOTONIC, &now_ts);
+        long long now = nano_from_ts(now_ts);
+
+        if (now < next_ns) {
+            struct itimerspec timer = {{0, 0}, ts_from_nano(next_ns)};
+            timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, nullptr);
+            errno = EAGAIN;
+            return -1;
+        }
+        /* No bursts to catch up after the process was stopped */
+        next_ns = std::max(next_ns, now - MILLISECOND) + SECOND / rate;
+    }
+
+    char* buffer = packet.get_buffer();
+    memcpy(buffer, frame, frame_size);
+    ((struct iphdr*)buffer)->daddr = get_in_addr(next_dest());
+    packet.set_size(frame_size);
+
+    packets_received++;
+    bytes_received += frame_size;
+    return frame_size;
+}
+
+void LoopbackNetwork::print_stats() const {
+    char buf[BUF_SIZE];
+
+    snprintf(buf, sizeof(buf),
+        "Network (loopback): %llu packets generated (%llu bytes), %llu delivered (%llu bytes)\n",
+        packets_received, bytes_received, packets_sent, bytes_sent);
+    Logger::print_string_safe(buf);
+    LOG(INFO, NETWORK, "%s", buf);
+}
+
+int LoopbackNetwork::next_dest() {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed % get_procs();
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#include <vector>
+#include <string>
+
+#include "packet.hpp"
+#include "network.hpp"
+#include "tun_network.hpp"
+#include "config-parser.hpp"
+#include "logger.hpp"
+
+/** @brief Network backend giving every process a TUN interface of its own
+ *
+ * Every process lives in its own network namespace, where a TUN
+ * interface has the address of the process and routes the whole
+ * subnetwork, so everything it sends carries its own address as the
+ * source. Packets of processes running at the same time are then told
+ * apart (@ref attributes_senders) and delivered to the TUN interface of
+ * the receiver without readdressing.
+ *
+ * Namespaces are created when the network is, processes join theirs
+ * when spawned (@ref enter_namespace). All TUN FDs are watched by an
+ * epoll instance, which is the FD polled for incoming packets. Needs
+ * `CAP_SYS_ADMIN` (namespaces) on top of `CAP_NET_ADMIN` (TUN).
+ */
+class NamespaceNetwork : public Network {
+
+    static const int EPOLL_EVENTS = 64; ///< Readable TUN FDs taken per epoll_wait
+
+    int own_ns_fd; ///< Network namespace of the emulator
+    std::vector<int> ns_fds; ///< Network namespace of every process
+    std::vector<int> tun_fds; ///< TUN FD of every process
+    int epoll_fd; ///< epoll instance watching all TUN FDs
+    std::vector<int> ready; ///< Processes whose TUN FD was readable, not yet drained
+
+    unsigned long long io_syscalls; ///< read/write/epoll_wait syscalls made
+
+public:
+
+    /** @brief Creates a namespace with TUN interface for every process
+     *
+     * @param cp Emulator's configuration read from a file
+     */
+    NamespaceNetwork(const ConfigParser& cp);
+    ~NamespaceNetwork();
+
+    /** @brief Get FD to poll for incoming packets
+     *
+     * @return epoll FD watching TUN FDs of all processes
+     */
+    int get_fd() const override;
+
+    /** @brief Send @p packet to the TUN interface of its destination
+     *
+     * @param packet Packet which will be sent (consumed)
+     */
+    void send(Packet&& packet) override;
+
+    /** @brief Does nothing, every send is written at once
+     */
+    void flush() override;
+
+    /** @brief Receive packet sent by any process
+     *
+     * @param packet Empty packet whose buffer will hold received data
+     * @return Number of received bytes (0 or -1 with EAGAIN if none)
+     */
+    ssize_t receive(Packet& packet) override;
+
+    /** @brief Print and log counters of TUN I/O
+     */
+    void print_stats() const override;
+
+    /** @brief Get address of process @p em_id itself
+     */
+    in_addr_t get_delivery_in_addr(int em_id) const override;
+
+    /** @brief Always true, sources are addresses of the senders
+     */
+    bool attributes_senders() const override;
+
+    /** @brief Switches calling thread to the namespace of @p em_id
+     */
+    void enter_namespace(int em_id) override;
+
+private:
+
+    /** @brief Brings up loopback interface of the current namespace
+     */
+    static void bring_up_loopback();
+
+};
+
+NamespaceNetwork::NamespaceNetwork(const ConfigParser& cp): Network(cp), io_syscalls(0) {
+    struct epoll_event event;
+
+    own_ns_fd = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+    if (own_ns_fd < 0)
+        panic("open own network namespace");
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        panic("epoll_create1");
+
+    for (int em_id = 0; em_id < get_procs(); ++em_id) {
+        if (unshare(CLONE_NEWNET) < 0)
+            panic("unshare(CLONE_NEWNET)");
+        ns_fds.push_back(open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC));
+        if (ns_fds.back() < 0)
+            panic("open network namespace");
+
+        bring_up_loopback();
+        tun_fds.push_back(TunNetwork::create_tun(cp.tun_dev_name, get_addr(em_id), cp.tun_mask));
+
+        event.events = EPOLLIN;
+        event.data.u32 = em_id;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tun_fds.back(), &event) < 0)
+            panic("epoll_ctl");
+    }
+    enter_namespace(-1);
+}
+
+NamespaceNetwork::~NamespaceNetwork() {
+    for (int fd: tun_fds)
+        close(fd);
+    for (int fd: ns_fds)
+        close(fd);
+    close(epoll_fd);
+    close(own_ns_fd);
+}
+
+int NamespaceNetwork::get_fd() const {
+    return epoll_fd;
+}
+
+void NamespaceNetwork::send(Packet&& packet) {
+    int dest = get_em_id(packet.get_dest_in_addr());
+    ssize_t ssize;
+
+    LOG_RECORD(TRACE, NETWORK, LogEvent::TUN_SEND, 
+        packet.get_source_in_addr(), packet.get_source_port_tcp(), 
+        packet.get_dest_in_addr(), packet.get_dest_port_tcp());
+
+    if (dest < 0)
+        return; /* Nobody behind that address */
+    packets_sent++;
+    ssize = write(tun_fds[dest], packet.get_buffer(), packet.get_size());
+    io_syscalls++;
+    if (ssize < 0)
+        panic("write");
+}
+
+void NamespaceNetwork::flush() {}
+
+ssize_t NamespaceNetwork::receive(Packet& packet) {
+    struct epoll_event events[EPOLL_EVENTS];
+    ssize_t ssize;
+    int count;
+
+    while (true) {
+        if (ready.empty()) {
+            count = epoll_wait(epoll_fd, events, EPOLL_EVENTS, 0);
+            io_syscalls++;
+            if (count <= 0) {
+                errno = EAGAIN;
+                return -1;
+            }
+            for (int i = 0; i < count; ++i)
+                ready.push_back(events[i].data.u32);
+        }
+
+        ssize = read(tun_fds[ready.back()], packet.get_buffer(), PacketPool::SLOT_SIZE);
+        io_syscalls++;
+        if (ssize < 0 && errno != EAGAIN)
+            panic("read");
+        if (ssize > 0) {
+            packet.set_size(ssize);
+            packets_received++;
+            return ssize;
+        }
+        ready.pop_back(); /* Drained */
+    }
+}
+
+void NamespaceNetwork::print_stats() const {
+    double per_syscall = io_syscalls ? 
+        (double)(packets_received + packets_sent) / io_syscalls : 0.0;
+    char buf[BUF_SIZE];
+
+    snprintf(buf, sizeof(buf), 
+        "Network (%d namespaces): %llu packets received, %llu sent, %llu syscalls, %.2f packets per syscall\n",
+        get_procs(), packets_received, packets_sent, io_syscalls, per_syscall);
+    Logger::print_string_safe(buf);
+    LOG(INFO, NETWORK, "%s", buf);
+}
+
+in_addr_t NamespaceNetwork::get_delivery_in_addr(int em_id) const {
+    return get_in_addr(em_id);
+}
+
+bool NamespaceNetwork::attributes_senders() const {
+    return true;
+}
+
+void NamespaceNetwork::enter_namespace(int em_id) {
+    if (setns(em_id < 0 ? own_ns_fd : ns_fds[em_id], CLONE_NEWNET) < 0)
+        panic("setns");
+}
+
+/* PRIVATE METHODS */
+
+void NamespaceNetwork::bring_up_loopback() {
+    struct ifreq ifr;
+    int ifd;
+
+    ifd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (ifd < 0)
+        panic("socket");
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, "lo", IFNAMSIZ);
+    ifr.ifr_flags = IFF_UP | IFF_LOOPBACK | IFF_RUNNING;
+    if (ioctl(ifd, SIOCSIFFLAGS, &ifr) < 0)
+        panic("ioctl(SIOCSIFFLAGS) lo");
+    close(ifd);
+}
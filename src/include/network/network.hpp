@@ -1,42 +1,59 @@
 #pragma once
 
-#include <linux/if.h>
-#include <linux/if_tun.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
+#include <arpa/inet.h>
 
 #include <vector>
-#include <fstream>
-#include <sstream>
+#include <unordered_map>
 #include <string>
-#include <iostream>
 
 #include "packet.hpp"
 #include "config-parser.hpp"
 #include "logger.hpp"
 
-/** @brief Class responsible for all network control and communication
+/** @brief Transport through which the emulator talks to emulated processes
  * 
- * Class builds and interacts with TUN interface. It sets all necessary 
- * interface settings and allows to send and receive packets through 
- * TUN file descriptor. This class also allows translation between emulator's
- * internal process id and process address and port in the TUN subnetwork. 
- * Additionally the pairwise processes latencies can be read through
- * the functionality provided by this class.
+ * Interface of network backends: sending packets to and receiving 
+ * packets from the running process (@ref send, @ref receive), and the
+ * FD to poll for incoming ones (@ref get_fd). Translation between 
+ * emulator's internal process id and process address in the emulated
+ * subnetwork, and pairwise latencies of processes, come from the 
+ * configuration and are shared by all backends.
+ * 
+ * Backends are @ref TunNetwork (real processes behind a TUN interface),
+ * @ref NamespaceNetwork (real processes, each behind a TUN interface of
+ * its own) and @ref LoopbackNetwork (synthetic packets in memory).
 */
 class Network {
 
-    int tun_fd; ///< FD of the TUN interface
-    const ConfigParser& cp; ///< Configuration read from the file by emulator
+    static const int MAX_INDEXED_HOST_BITS = 20; ///< Largest subnetwork indexed directly
+
     struct timespec max_latency; ///< Calculated max pairwise latency
 
+    std::vector<in_addr_t> proc_addrs; ///< Address of every process (network byte order)
+    in_addr_t inter_addr; ///< Address of the TUN interface (network byte order)
+    uint32_t subnet; ///< TUN subnetwork address (host byte order)
+    uint32_t subnet_mask; ///< TUN subnetwork mask (host byte order)
+    std::vector<int> subnet_index; ///< em_id of every host in the subnetwork (-1 if none), empty if not used
+    std::unordered_map<in_addr_t, int> addr_index; ///< em_id of every address, used when subnet_index is not
+
+protected:
+
+    const ConfigParser& cp; ///< Configuration read from the file by emulator
+
+    unsigned long long packets_received; ///< Packets received from processes
+    unsigned long long packets_sent; ///< Packets sent to processes
+
 public:
 
-    /** @brief Build TUN interface and set necessary constants
+    /** @brief Indexes addresses of processes of @p cp
      * 
      * @param cp Emulator's configuration read from a file 
      */
     Network(const ConfigParser& cp);
+    virtual ~Network() = default;
+
+    Network(const Network&) = delete;
+    Network& operator=(const Network&) = delete;
 
     /** @brief Get latency between process @p em_id1 and process @p em_id2 
      * 
@@ -65,6 +82,17 @@ public:
      */
     int get_em_id(const std::string& address) const;
 
+    /** @brief Get emulator's internal id of process with given address in O(1)
+     * 
+     * Addresses inside the TUN subnetwork (if it has at most 
+     * 2^@ref MAX_INDEXED_HOST_BITS hosts) are looked up directly by 
+     * their host part, otherwise in a hash table.
+     * 
+     * @param address The address (network byte order) on which to query
+     * @return Internal id of process associated with this address (-1 if none)
+     */
+    int get_em_id(in_addr_t address) const;
+
     /** @brief Get address of a process with given internal id
      * 
      * @param em_id The id on which to query
@@ -72,53 +100,100 @@ public:
      */
     std::string get_addr(int em_id) const;
 
+    /** @brief Get address of a process with given internal id as an integer
+     * 
+     * @param em_id The id on which to query
+     * @return Address (network byte order) associated with this internal id
+     */
+    in_addr_t get_in_addr(int em_id) const;
+
     /** @brief Get address of TUN interface
      * 
      * @return Address (in number/dot form) of the TUN interface
      */
     std::string get_inter_addr() const;
 
-    /** @brief Send the buffer of @p packet object through TUN FD
+    /** @brief Get address of TUN interface as an integer
      * 
-     * @param packet Packet which will be sent
+     * @return Address (network byte order) of the TUN interface
      */
-    void send(const Packet& packet) const;
+    in_addr_t get_inter_in_addr() const;
 
-    /** @brief Receive data through TUN FD
+    /** @brief Get FD to poll for incoming packets
      * 
-     * @param buffer Placeholder to which received data will be copied
-     * @param buffer_size Available place for new data
-     * @return Number of received bytes (0 if none)
+     * @return FD which is readable when @ref receive may return a packet
      */
-    ssize_t receive(char* buffer, size_t buffer_size) const;
+    virtual int get_fd() const = 0;
 
-private:
+    /** @brief Deliver @p packet to the running process
+     * 
+     * Backends may only queue the packet, see @ref flush.
+     * 
+     * @param packet Packet which will be sent (consumed)
+     */
+    virtual void send(Packet&& packet) = 0;
 
-    /** @brief Creates and customizes the TUN interface and its subnetwork
+    /** @brief Hand over all sends queued since last flush
      */
-    void create_tun();
+    virtual void flush() = 0;
 
-};
+    /** @brief Receive packet sent by the running process
+     * 
+     * @param packet Empty packet whose buffer will hold received data
+     * @return Number of received bytes (0 or -1 with EAGAIN if none)
+     */
+    virtual ssize_t receive(Packet& packet) = 0;
 
-Network::Network(const ConfigParser& cp): cp(cp) {
-    create_tun();
+    /** @brief Print and log counters of the backend
+     */
+    virtual void print_stats() const = 0;
 
-    max_latency = timespec{0, 0};
+    /** @brief Get address packets for process @p em_id are delivered from
+     * 
+     * Processes behind a shared TUN interface get everything from its
+     * address, processes with an interface of their own from the 
+     * address of the sender (packets are not readdressed).
+     * 
+     * @param em_id Receiving process
+     * @return Address (network byte order) delivered packets come to 
+     *         @p em_id at
+     */
+    virtual in_addr_t get_delivery_in_addr(int em_id) const;
 
-    for (int i = 0; i < cp.procs; ++i) {
-        for (int j = 0; j < cp.procs; ++j) {
-            if (ts_from_nano(cp.latency[i][j]) > max_latency) 
-                max_latency = ts_from_nano(cp.latency[i][j]);
-        }
-    }
+    /** @brief Whether received packets carry the address of their sender
+     * 
+     * Only then several processes may run at once, otherwise a packet
+     * is known to come from the running process only.
+     * 
+     * @return True if @ref get_em_id of the source address is the sender
+     */
+    virtual bool attributes_senders() const;
+
+    /** @brief Makes processes spawned by the calling thread from now on
+     *         join the network of @p em_id
+     * 
+     * Does nothing unless every process has its own network namespace.
+     * 
+     * @param em_id Process about to be spawned (-1 for the emulator's 
+     *        own network)
+     */
+    virtual void enter_namespace(int em_id);
+
+private:
 
-    // for (int i = 0; i < cp.procs; ++i) {
-    //     printf("[Network.hpp] em_id: %d, addr: %s\n", i, get_addr(i).c_str());
-    // }
+    /** @brief Builds the table translating addresses to internal ids
+     */
+    void index_addresses();
+
+};
+
+Network::Network(const ConfigParser& cp): cp(cp), packets_received(0), packets_sent(0) {
+    index_addresses();
+    max_latency = ts_from_nano(cp.latency.get_max());
 }
 
 struct timespec Network::get_latency(int em_id1, int em_id2) const {
-    return ts_from_nano(cp.latency[em_id1][em_id2]);
+    return ts_from_nano(cp.latency.get(em_id1, em_id2));
 }
 
 struct timespec Network::get_max_latency() const {
@@ -130,101 +205,73 @@ int Network::get_procs() const {
 }
 
 int Network::get_em_id(const std::string& address) const {
-    for (int em_id = 0; em_id < cp.procs; ++em_id) {
-        if (address == cp.addresses[em_id].first)
-            return em_id;
+    struct in_addr addr;
+    if (inet_pton(AF_INET, address.c_str(), &addr) != 1)
+        return -1; // address unavailable
+    return get_em_id(addr.s_addr);
+}
+
+int Network::get_em_id(in_addr_t address) const {
+    if (!subnet_index.empty()) {
+        uint32_t host = ntohl(address);
+        if ((host & subnet_mask) != subnet)
+            return -1; // address unavailable
+        return subnet_index[host - subnet];
     }
-    return -1; // address unavailable
+
+    auto it = addr_index.find(address);
+    return it == addr_index.end() ? -1 : it->second;
 }
 
 std::string Network::get_addr(int em_id) const {
-    return cp.addresses[em_id].first;
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &proc_addrs[em_id], address, sizeof(address));
+    return address;
+}
+
+in_addr_t Network::get_in_addr(int em_id) const {
+    return proc_addrs[em_id];
 }
+
 std::string Network::get_inter_addr() const {
     return cp.tun_addr;
 }
 
-void Network::send(const Packet& packet) const {
-    ssize_t ssize;
-    size_t to_send = packet.get_size(), offset = 0;
-
-	while (to_send > 0) {
-		ssize = write(tun_fd, packet.get_buffer(), to_send);
-		if (ssize < 0)
-			panic("write");
-
-		offset += (size_t) ssize;
-		to_send -= (size_t) ssize;
-	}
-
-    logger_ptr->log_event("Packet send from %s.%d to %s.%d", 
-        packet.get_source_addr().c_str(), packet.get_source_port_tcp(), 
-        packet.get_dest_addr().c_str(), packet.get_dest_port_tcp());
-    // printf("Packet send from %s.%d to %s.%d\n", 
-    //     packet.get_source_addr().c_str(), packet.get_source_port_tcp(), 
-    //     packet.get_dest_addr().c_str(), packet.get_dest_port_tcp());
+in_addr_t Network::get_inter_in_addr() const {
+    return inter_addr;
 }
 
-ssize_t Network::receive(char* buffer, size_t buffer_size) const {
-    // printf("[network.hpp]Buffer: %s\n", buffer);
-    ssize_t ssize = read(tun_fd, buffer, buffer_size);
-    if (ssize < 0 && errno != EAGAIN)
-        panic("read");
-    return ssize;
+in_addr_t Network::get_delivery_in_addr(int em_id) const {
+    return inter_addr;
 }
 
-void Network::create_tun() {
-	static const char clonedev[] = "/dev/net/tun";
-	struct sockaddr_in sin;
-	struct ifreq ifr;
-	int ifd;
-    char inter[IFNAMSIZ];
-    strcpy(inter, cp.tun_dev_name.c_str());
-
-	tun_fd = open(clonedev, O_RDWR);
-	if (tun_fd < 0)
-		panic("open");
-
-	memset(&ifr, 0, sizeof (ifr));
-	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
-	strncpy(ifr.ifr_name, inter, IFNAMSIZ);
-
-	if (ioctl(tun_fd, TUNSETIFF, &ifr) < 0)
-		panic("ioctl(TUNSETIFF)");
-
-	strncpy(inter, ifr.ifr_name, IFNAMSIZ);
-
-	memset(&ifr, 0, sizeof (ifr));
-	strncpy(ifr.ifr_name, inter, IFNAMSIZ);
-	ifr.ifr_flags =
-		(short) (IFF_UP | IFF_BROADCAST | IFF_MULTICAST | IFF_DYNAMIC);
-
-	ifd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
-	if (ifd < 0)
-		panic("socket");
+bool Network::attributes_senders() const {
+    return false;
+}
 
-	if (ioctl(ifd, SIOCSIFFLAGS, &ifr) < 0)
-		panic("ioctl(SIOCSIFFLAGS)");
+void Network::enter_namespace(int em_id) {
+}
 
-	sin.sin_family = AF_INET;
-	inet_pton(AF_INET, cp.tun_addr.c_str(), &sin.sin_addr);
-	memset(&ifr, 0, sizeof (ifr));
-	strncpy(ifr.ifr_name, inter, IFNAMSIZ);
-	ifr.ifr_addr = *(struct sockaddr *) &sin;
+void Network::index_addresses() {
+    bool in_subnet = true;
 
-	if (ioctl(ifd, SIOCSIFADDR, &ifr) < 0)
-		panic("ioctl(SIOCSIFADDR)");
+    inter_addr = inet_addr(cp.tun_addr.c_str());
+    subnet_mask = ntohl(inet_addr(cp.tun_mask.c_str()));
+    subnet = ntohl(inter_addr) & subnet_mask;
 
-	sin.sin_family = AF_INET;
-	inet_pton(AF_INET, cp.tun_mask.c_str(), &sin.sin_addr);
-	memset(&ifr, 0, sizeof (ifr));
-	strncpy(ifr.ifr_name, inter, IFNAMSIZ);
-	ifr.ifr_netmask = *(struct sockaddr *) &sin;
+    for (int em_id = 0; em_id < cp.procs; ++em_id) {
+        proc_addrs.push_back(cp.addrs[em_id]);
+        addr_index.emplace(proc_addrs.back(), em_id);
+        in_subnet &= (ntohl(proc_addrs.back()) & subnet_mask) == subnet;
+    }
 
-	if (ioctl(ifd, SIOCSIFNETMASK, &ifr) < 0)
-		panic("ioctl(SIOCSIFNETMASK)");
+    /* Index directly by host part if the subnetwork is small enough */
+    uint64_t hosts = (uint64_t)(~subnet_mask) + 1;
+    if (!in_subnet || hosts > (1ULL << MAX_INDEXED_HOST_BITS))
+        return;
 
-	/* Setting the tun_fd to have non-blocking read */
-	int flags = fcntl(tun_fd, F_GETFL, 0);
-	fcntl(tun_fd, F_SETFL, flags | O_NONBLOCK);
-}
+    subnet_index.assign(hosts, -1);
+    for (int em_id = cp.procs - 1; em_id >= 0; --em_id)
+        subnet_index[ntohl(proc_addrs[em_id]) - subnet] = em_id;
+    addr_index.clear();
+}
\ No newline at end of file
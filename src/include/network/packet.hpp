@@ -16,18 +16,19 @@
 #include <vector>
 #include <queue>
 #include <algorithm>
+#include <utility>
 
 #include "utils.hpp"
-
-#define MTU 1500
+#include "packet_pool.hpp"
 
 /** @brief Class encapsulating single ip frame sent through TUN interface
  * 
  * Instances of this class are moved around the emulator system to keep track
- * of which process messaged which process and at what time. As those instances
- * would be put to different priority_queue all types of constructors need to be
- * implemented. Packets would be sorted on the @ref ts parameter (signifying 
- * virtual clock value of the sending process). 
+ * of which process messaged which process and at what time. Packets are
+ * move-only handles of a @ref PacketPool slot, so the frame is written once
+ * (by the TUN read) and read once (by the TUN write) wherever the packet
+ * travels in between. Packets would be sorted on the @ref ts parameter 
+ * (signifying virtual clock value of the sending process). 
  * 
  * It's worth noting, that in the current form packet code works ONLY for 
  * IPv4 and UDP protocol.
@@ -38,32 +39,39 @@ public:
 
     /** @brief Main packet constructor from data read from TUN FD
      * 
-     * Constructors copies data from the @p buf to newly allocated 
-     * @ref buffer which is freed in destructor 
+     * Constructors copies data from the @p buf to a @ref buffer taken
+     * from @ref PacketPool, which is given back in destructor 
      * 
      * @param buf Char buffer read from TUN FD
-     * @param size Number of bytes read
+     * @param size Number of bytes read (at most @ref PacketPool::SLOT_SIZE)
      * @param ts Virtual clock value of the sending process
      */
     Packet(const char* buf, size_t size, struct timespec ts);
 
-    /** @brief Copy constructor
+    /** @brief Constructor of an empty packet to be filled in place
+     * 
+     * Takes a slot from @ref PacketPool without copying anything into it,
+     * data is expected to be written to @ref get_buffer (e.g. by a TUN read)
+     * and its length set with @ref set_size.
      * 
-     * @param other Packet to copy from
+     * @param ts Virtual clock value of the sending process
      */
-    Packet(const Packet &other);
+    Packet(struct timespec ts);
+
+    Packet(const Packet &other) = delete;
+    Packet& operator=(const Packet& other) = delete;
     
     /** @brief Move constructor
      * 
      * @param other Packet which insides will be moved here
      */
-    Packet(Packet&& other);
+    Packet(Packet&& other) noexcept;
 
-    /** @brief Assignment operator
+    /** @brief Move assignment operator
      * 
-     * @param other Original packet
+     * @param other Packet which insides will be moved here
      */
-    Packet& operator=(const Packet& other);
+    Packet& operator=(Packet&& other) noexcept;
 
     /** @brief Comparison operator (comparison based on timestamp)
      * 
@@ -94,6 +102,22 @@ public:
      */
     char* get_buffer() const;
 
+    /** @brief Set size of data written to packet buffer in place
+     * 
+     * @param size Number of bytes (at most @ref PacketPool::SLOT_SIZE)
+     */
+    void set_size(size_t size);
+
+    /** @brief Exchange packet buffer with @p slot
+     * 
+     * Lets the network hand over a pool slot it read into, or take 
+     * ownership of the slot for the time of an asynchronous write.
+     * 
+     * @param slot Pool slot (or nullptr) the packet will own from now on
+     * @return Slot previously owned by the packet
+     */
+    char* swap_buffer(char* slot);
+
     /** @brief Get packet timestamp (private variable)
      * 
      * @return Packet timestamp
@@ -112,6 +136,22 @@ public:
      */
     std::string get_dest_addr() const;
 
+    /** @brief Get packet source address (from IPv4 header) as an integer
+     * 
+     * Unlike @ref get_source_addr, doesn't build a string.
+     * 
+     * @return Packet source address (network byte order)
+     */
+    in_addr_t get_source_in_addr() const;
+
+    /** @brief Get packet destination address (from IPv4 header) as an integer
+     * 
+     * Unlike @ref get_dest_addr, doesn't build a string.
+     * 
+     * @return Packet destination address (network byte order)
+     */
+    in_addr_t get_dest_in_addr() const;
+
     /** @brief Get packet source port (from UDP header)
      * 
      * @return Packet source port
@@ -142,6 +182,12 @@ public:
      */
     int get_tcp_checksum() const;
 
+    /** @brief Get packet UDP checksum (computed over the whole datagram)
+     * 
+     * @return Packet UDP checksum
+     */
+    int get_udp_checksum() const;
+
     /** @brief Dump packet contents in hex format to stdout
      */
     void dump();
@@ -150,7 +196,8 @@ public:
      * 
      * Changes packets buffer value so that the source address is updated.
      * This requires the IPv4 checksum to be updated, as well as the
-     * UDP checksum in udphdr to be updated.
+     * UDP checksum in udphdr to be updated. Both are updated incrementally
+     * from the old and new address (RFC 1624), independently of payload size.
      * 
      * @param addr New source address (in number/dot form)
      */
@@ -160,21 +207,41 @@ public:
      * 
      * Changes packets buffer value so that the destination address is updated.
      * This requires the IPv4 checksum to be updated, as well as the
-     * UDP checksum in udphdr to be updated.
+     * UDP checksum in udphdr to be updated. Both are updated incrementally
+     * from the old and new address (RFC 1624), independently of payload size.
      * 
      * @param addr New destination address (in number/dot form)
      */
     void set_dest_addr(const std::string& addr);
 
     /** @brief Set a new source address for the packet in TCP
+     * 
+     * IPv4 and TCP checksums are updated incrementally (RFC 1624).
+     * 
      * @param addr New source address (in number/dot form)
      */
     void set_source_addr_tcp(const std::string& addr);
 
     /** @brief Set a new destination address for the packet in TCP
+     * 
+     * IPv4 and TCP checksums are updated incrementally (RFC 1624).
+     * 
      * @param addr New destination address (in number/dot form)
      */
     void set_dest_addr_tcp(const std::string& addr);
+
+    /** @brief Set new source and destination addresses of the packet
+     * 
+     * IPv4 checksum and the checksum of the transport layer (TCP or UDP,
+     * chosen by the IPv4 protocol field) are updated incrementally 
+     * (RFC 1624), so the cost doesn't depend on payload size. Other
+     * protocols (e.g. ICMP) have no pseudo header, only the IPv4 
+     * checksum is updated for them.
+     * 
+     * @param source New source address (network byte order)
+     * @param dest New destination address (network byte order)
+     */
+    void rewrite_addrs(in_addr_t source, in_addr_t dest);
     
     /** @brief Increase packet's @ref ts value by @p other_ts 
      * 
@@ -184,7 +251,7 @@ public:
 
 private:
 
-    char* buffer; ///< Buffer in which raw data is stored
+    char* buffer; ///< Pool slot in which raw data is stored (nullptr if moved from)
     size_t size; ///< Size of data stored in the packet
     struct timespec ts; ///< Packets timestamp
 
@@ -196,6 +263,17 @@ private:
     char* get_data_tcp() const;
     size_t get_data_len_tcp() const;
 
+    /** @brief Checksum @p check updated for 32-bit word @p old_word 
+     *         replaced by @p new_word (RFC 1624, eqn. 3)
+     */
+    static uint16_t checksum_update(uint16_t check, uint32_t old_word, uint32_t new_word);
+
+    /** @brief Replaces address @p field (saddr or daddr) with @p addr updating
+     *         IPv4 checksum and the checksum of @p protocol if it's 
+     *         IPPROTO_TCP or IPPROTO_UDP
+     */
+    void replace_addr(uint32_t* field, uint32_t addr, int protocol);
+
     uint16_t ip4_checksum(const struct iphdr *ip) const;
     uint16_t udp_checksum(const struct iphdr *ip, 
         const struct udphdr* udp, const char* data, size_t data_len) const;
@@ -207,33 +285,32 @@ private:
 
 Packet::Packet(const char* buf, size_t size, struct timespec ts): 
         size(size), ts(ts) {
-    buffer = (char*)malloc(size * sizeof(char));
+    assert(size <= PacketPool::SLOT_SIZE);
+    buffer = PacketPool::instance().acquire();
     memcpy(buffer, buf, size);
 }
 
-Packet::Packet(const Packet &other): 
-        size(other.size), ts(other.ts) {
-    buffer = (char*)malloc(size * sizeof(char));
-    memcpy(buffer, other.buffer, size);
+Packet::Packet(struct timespec ts): size(0), ts(ts) {
+    buffer = PacketPool::instance().acquire();
 }
 
-Packet::Packet(Packet&& other): 
+Packet::Packet(Packet&& other) noexcept: 
         buffer(other.buffer), size(other.size), ts(other.ts) {
     other.buffer = nullptr;
 }
 
-Packet& Packet::operator=(const Packet& other) {
+Packet& Packet::operator=(Packet&& other) noexcept {
     if (this != &other) {
+        std::swap(buffer, other.buffer);
         size = other.size;
         ts = other.ts;
-        buffer = (char*)malloc(size * sizeof(char));
-        memcpy(buffer, other.buffer, size);
     }
     return *this;
 }
 
 Packet::~Packet() {
-    free(buffer);
+    if (buffer != nullptr)
+        PacketPool::instance().release(buffer);
 }
 
 bool Packet::operator<(const Packet& other) const {
@@ -296,6 +373,16 @@ char* Packet::get_buffer() const {
     return buffer;
 }
 
+void Packet::set_size(size_t size) {
+    assert(size <= PacketPool::SLOT_SIZE);
+    this->size = size;
+}
+
+char* Packet::swap_buffer(char* slot) {
+    std::swap(buffer, slot);
+    return slot;
+}
+
 struct timespec Packet::get_ts() const {
     return ts;
 }
@@ -314,6 +401,14 @@ std::string Packet::get_dest_addr() const {
     return std::string(buf);
 }
 
+in_addr_t Packet::get_source_in_addr() const {
+    return get_iphdr()->saddr;
+}
+
+in_addr_t Packet::get_dest_in_addr() const {
+    return get_iphdr()->daddr;
+}
+
 int Packet::get_source_port() const {
     const struct udphdr *udp = reinterpret_cast<const struct udphdr *>
         (buffer + sizeof(struct iphdr));
@@ -340,110 +435,80 @@ int Packet::get_dest_port_tcp() const {
 }
 
 void Packet::set_source_addr(const std::string& addr) {
-    struct iphdr *ip = get_iphdr();
-    struct udphdr *udp = get_udp();
+    replace_addr(&get_iphdr()->saddr, inet_addr(addr.c_str()), IPPROTO_UDP);
+}
 
-    ip->saddr = inet_addr(addr.c_str());
-    ip->check = htons(ip4_checksum(ip));
+void Packet::set_source_addr_tcp(const std::string& addr) {
+    replace_addr(&get_iphdr()->saddr, inet_addr(addr.c_str()), IPPROTO_TCP);
+}
 
-    for (size_t i = 0; i < ip->ihl * sizeof(uint32_t); ++i) {
-		buffer[i] = *(((uint8_t*) ip) + i);
-	}
+void Packet::set_dest_addr(const std::string& addr) {
+    replace_addr(&get_iphdr()->daddr, inet_addr(addr.c_str()), IPPROTO_UDP);
+}
 
-    if (has_transport_layer_hdr()) {
-        udp->check = udp_checksum(ip, udp, get_data(), get_data_len());
-        for (size_t i = 0; i < sizeof(*udp); ++i) {
-            buffer[ip->ihl * sizeof(uint32_t) + i] = *(((uint8_t*)udp) + i);
-        }
-    }
+void Packet::set_dest_addr_tcp(const std::string& addr) {
+    replace_addr(&get_iphdr()->daddr, inet_addr(addr.c_str()), IPPROTO_TCP);
 }
 
-void Packet::set_source_addr_tcp(const std::string& addr) {
-    struct iphdr *ip = get_iphdr();
-    // std::cout << "ip hdr get here" << std::endl;
-    struct tcphdr *tcp = get_tcp();
+void Packet::rewrite_addrs(in_addr_t source, in_addr_t dest) {
+    int protocol = get_iphdr()->protocol;
+    replace_addr(&get_iphdr()->saddr, source, protocol);
+    replace_addr(&get_iphdr()->daddr, dest, protocol);
+}
 
-    // std::cout << "SET TCP SRC ADDR here" << std::endl;
-    ip->saddr = inet_addr(addr.c_str());
-    // ip->protocol = IPPROTO_TCP;
-    ip->check = htons(ip4_checksum(ip));
+void Packet::increase_ts(struct timespec other_ts) {
+    ts = ts + other_ts;
+}
 
-    for (size_t i = 0; i < ip->ihl * sizeof(uint32_t); ++i) {
-		buffer[i] = *(((uint8_t*) ip) + i);
-	}
+int Packet::get_tcp_checksum() const {
+    return tcp_checksum(get_iphdr(), get_tcp(), get_data_tcp(), get_data_len_tcp());
+}
 
-    if (has_transport_layer_hdr()) {
-        // tcp->check = ntohs(tcp_checksum(ip, tcp, get_data_tcp(), get_data_len_tcp()));
-        tcp->check = ntohs(get_tcp_checksum());
-        // std::cout << "Checksum set: " << std::hex << tcp->check << std::endl;
-        for (size_t i = 0; i < sizeof(*tcp); ++i) {
-            buffer[ip->ihl * sizeof(uint32_t) + i] = *(((uint8_t*) tcp) + i);
-        }
-    }
+int Packet::get_udp_checksum() const {
+    return udp_checksum(get_iphdr(), get_udp(), get_data(), get_data_len());
 }
 
-void Packet::set_dest_addr(const std::string& addr) {
-    struct iphdr *ip = get_iphdr();
-    struct udphdr *udp = get_udp();
+/* PRIVATE METHODS */
 
-    ip->daddr = inet_addr(addr.c_str());
-    ip->check = htons(ip4_checksum(ip));
+uint16_t Packet::checksum_update(uint16_t check, uint32_t old_word, uint32_t new_word) {
+    /* HC' = ~(~HC + ~m + m'), on 16-bit halves as stored in the buffer */
+    uint32_t sum = (uint16_t)~check;
+    sum += (uint16_t)~(old_word & 0xffff) + (uint16_t)~(old_word >> 16);
+    sum += (new_word & 0xffff) + (new_word >> 16);
 
-    for (size_t i = 0; i < ip->ihl * sizeof(uint32_t); ++i) {
-		buffer[i] = *(((uint8_t*) ip) + i);
-	}
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
 
-    if (has_transport_layer_hdr()) {
-        udp->check = udp_checksum(ip, udp, get_data(), get_data_len());
-        for (size_t i = 0; i < sizeof(*udp); ++i) {
-            buffer[ip->ihl * sizeof(uint32_t) + i] = *(((uint8_t*)udp) + i);
-        }
-    }
+    return ~((uint16_t)sum);
 }
 
-void Packet::set_dest_addr_tcp(const std::string& addr) {
+void Packet::replace_addr(uint32_t* field, uint32_t addr, int protocol) {
     struct iphdr *ip = get_iphdr();
-    // std::cout << "ip hdr get here" << std::endl;
-    struct tcphdr *tcp = get_tcp();
-    // std::cout << "tcp hdr get here" << std::endl;
+    uint32_t old_addr = *field;
 
-    ip->daddr = inet_addr(addr.c_str());
-    // ip->protocol = IPPROTO_TCP;
-    ip->check = htons(ip4_checksum(ip));
+    if (old_addr == addr)
+        return;
 
-    // std::cout << "checksum set" << std::endl;
+    *field = addr;
+    ip->check = checksum_update(ip->check, old_addr, addr);
 
-    for (size_t i = 0; i < ip->ihl * sizeof(uint32_t); ++i) {
-		buffer[i] = *(((uint8_t*) ip) + i);
-	}
-
-    // std::cout << "buffer load" << std::endl;
-
-    if (has_transport_layer_hdr()) {
-        // std::cout << "has transport layer hdr" << std::endl;
+    if (!has_transport_layer_hdr())
+        return;
 
-        // std::cout << "data_len " << get_data_len_tcp() << std::endl;
-        // std::cout << "tcp_checksum" << std::hex << tcp_checksum(ip, tcp, get_data_tcp(), get_data_len_tcp()) << std::endl;
-        // tcp->check = ntohs(tcp_checksum(ip, tcp, get_data_tcp(), get_data_len_tcp()));
-        tcp->check = ntohs(get_tcp_checksum());
-        // std::cout << "Checksum set: " << std::hex << tcp->check << std::endl;
-        for (size_t i = 0; i < sizeof(*tcp); ++i) {
-            buffer[ip->ihl * sizeof(uint32_t) + i] = *(((uint8_t*) tcp) + i);
-        }
+    if (protocol == IPPROTO_TCP) {
+        struct tcphdr *tcp = get_tcp();
+        tcp->check = checksum_update(tcp->check, old_addr, addr);
+    }
+    else if (protocol == IPPROTO_UDP) {
+        struct udphdr *udp = get_udp();
+        if (udp->check == 0)
+            return; /* UDP checksum not in use */
+        udp->check = checksum_update(udp->check, old_addr, addr);
+        if (udp->check == 0)
+            udp->check = 0xffff;
     }
-    
-}
-
-void Packet::increase_ts(struct timespec other_ts) {
-    ts = ts + other_ts;
-}
-
-int Packet::get_tcp_checksum() const {
-    return tcp_checksum(get_iphdr(), get_tcp(), get_data_tcp(), get_data_len_tcp());
 }
 
-/* PRIVATE METHODS */
-
 struct iphdr* Packet::get_iphdr() const {
     return reinterpret_cast<struct iphdr*>(buffer);
 }
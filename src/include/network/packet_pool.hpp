@@ -0,0 +1,166 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "utils.hpp"
+#include "logger.hpp"
+
+#define MTU 1500
+
+/** @brief Pool of fixed size buffers holding packet frames
+ *
+ * Every slot is large enough for one MTU-sized frame (rounded up to a
+ * cache line). Slots are carved from 2 MB chunks, mapped with
+ * `MAP_HUGETLB` if hugepages were requested and are available, and kept
+ * on a free list - so acquiring and releasing a slot never calls
+ * `malloc`. Chunks are never returned to the system.
+ *
+ * The pool is not thread-safe, it's used only by the emulator's thread.
+ */
+class PacketPool {
+
+    static const size_t CHUNK_SIZE = 2 * 1024 * 1024; ///< Size of a single mapped chunk
+
+    std::vector<char*> free_slots; ///< Slots available for acquiring
+    std::vector<void*> chunks; ///< Mapped chunks
+    bool use_hugepages; ///< Whether to try mapping chunks with hugepages
+    size_t hugepage_chunks; ///< Number of chunks backed by hugepages
+    size_t in_use; ///< Slots currently acquired
+    size_t high_water; ///< Max slots acquired at once
+    size_t capacity; ///< Total number of slots in all chunks
+
+public:
+
+    static const size_t SLOT_SIZE = (MTU + 63) / 64 * 64; ///< Size of a single slot
+
+    /** @brief Get the pool shared by all packets
+     *
+     * @return Global packet pool
+     */
+    static PacketPool& instance();
+
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    /** @brief Map chunks allocated from now on with hugepages (when available)
+     *
+     * @param enable Whether to use hugepages
+     */
+    void set_hugepages(bool enable);
+
+    /** @brief Take a free slot from the pool, mapping a new chunk if needed
+     *
+     * @return Buffer of @ref SLOT_SIZE bytes
+     */
+    char* acquire();
+
+    /** @brief Give @p slot back to the pool
+     *
+     * @param slot Buffer previously returned by @ref acquire
+     */
+    void release(char* slot);
+
+    size_t get_in_use() const;
+    size_t get_high_water() const;
+    size_t get_capacity() const;
+
+    /** @brief Print occupancy and high-water mark of the pool
+     */
+    void print_stats() const;
+
+private:
+
+    PacketPool();
+
+    /** @brief Maps a new chunk and puts all its slots on the free list
+     */
+    void grow();
+
+};
+
+PacketPool& PacketPool::instance() {
+    static PacketPool pool;
+    return pool;
+}
+
+PacketPool::PacketPool(): use_hugepages(false), hugepage_chunks(0),
+        in_use(0), high_water(0), capacity(0) {}
+
+PacketPool::~PacketPool() {
+    for (void* chunk: chunks)
+        munmap(chunk, CHUNK_SIZE);
+}
+
+void PacketPool::set_hugepages(bool enable) {
+    use_hugepages = enable;
+}
+
+char* PacketPool::acquire() {
+    if (free_slots.empty())
+        grow();
+
+    char* slot = free_slots.back();
+    free_slots.pop_back();
+
+    if (++in_use > high_water)
+        high_water = in_use;
+    return slot;
+}
+
+void PacketPool::release(char* slot) {
+    free_slots.push_back(slot);
+    in_use--;
+}
+
+size_t PacketPool::get_in_use() const {
+    return in_use;
+}
+
+size_t PacketPool::get_high_water() const {
+    return high_water;
+}
+
+size_t PacketPool::get_capacity() const {
+    return capacity;
+}
+
+void PacketPool::print_stats() const {
+    char buf[BUF_SIZE];
+
+    snprintf(buf, sizeof(buf),
+        "Packet pool: %zu/%zu slots in use, high-water mark %zu, %zu chunks (%zu on hugepages)\n",
+        in_use, capacity, high_water, chunks.size(), hugepage_chunks);
+    Logger::print_string_safe(buf);
+}
+
+/* PRIVATE METHODS */
+
+void PacketPool::grow() {
+    void* chunk = MAP_FAILED;
+
+    if (use_hugepages) {
+        chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (chunk != MAP_FAILED)
+            hugepage_chunks++;
+    }
+    if (chunk == MAP_FAILED)
+        chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED)
+        panic("mmap");
+
+    chunks.push_back(chunk);
+    size_t slots = CHUNK_SIZE / SLOT_SIZE;
+    for (size_t i = slots; i > 0; --i)
+        free_slots.push_back((char*)chunk + (i - 1) * SLOT_SIZE);
+    capacity += slots;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#include "packet.hpp"
+
+/** @brief Priority queue of packets, earliest timestamp on top
+ *
+ * Same ordering as `std::priority_queue<Packet>`, but the top packet can
+ * be moved out with @ref pop, so packets travel between queues without
+ * copying their frames.
+ */
+class PacketQueue {
+
+    std::vector<Packet> heap; ///< Binary heap ordered by Packet::operator<
+
+public:
+
+    /** @brief Inserts @p packet into the queue
+     *
+     * @param packet Packet to be moved into the queue
+     */
+    void push(Packet&& packet);
+
+    /** @brief Get the packet with the earliest timestamp
+     *
+     * @return Packet on top of the queue (queue must not be empty)
+     */
+    const Packet& top() const;
+
+    /** @brief Removes the packet with the earliest timestamp and returns it
+     *
+     * @return Packet moved out of the queue (queue must not be empty)
+     */
+    Packet pop();
+
+    bool empty() const;
+    size_t size() const;
+
+};
+
+void PacketQueue::push(Packet&& packet) {
+    heap.push_back(std::move(packet));
+    std::push_heap(heap.begin(), heap.end());
+}
+
+const Packet& PacketQueue::top() const {
+    return heap.front();
+}
+
+Packet PacketQueue::pop() {
+    std::pop_heap(heap.begin(), heap.end());
+    Packet packet(std::move(heap.back()));
+    heap.pop_back();
+    return packet;
+}
+
+bool PacketQueue::empty() const {
+    return heap.empty();
+}
+
+size_t PacketQueue::size() const {
+    return heap.size();
+}
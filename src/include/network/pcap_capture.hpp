@@ -0,0 +1,189 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <string>
+#include <memory>
+
+#include "utils.hpp"
+#include "logger.hpp"
+#include "async_writer.hpp"
+#include "network/packet.hpp"
+#include "network/network.hpp"
+
+/** @brief Writes routed packets to a pcapng file, stamped with virtual times
+ *
+ * The file has one interface per emulated process (named after the
+ * process and its address), with raw IPv4 link type and nanosecond
+ * timestamps. Every packet is an Enhanced Packet Block on the interface
+ * of its sender, stamped with its virtual send time; the receiver and
+ * virtual delivery time (or the drop) are in the comment of the block.
+ *
+ * Blocks go through an @ref AsyncWriter, the packet buffer is copied
+ * once, straight into its ring. When the file can't keep up, packets
+ * are left out of the capture (and counted), the emulation never waits.
+ */
+class PcapCapture {
+
+    static const size_t RING_SIZE = 16 * 1024 * 1024; ///< Bytes buffered before packets are dropped
+    static const int COMMENT_SIZE = 64; ///< Room for the comment of a packet
+
+    static const uint32_t BLOCK_SHB = 0x0A0D0D0A; ///< Section Header Block
+    static const uint32_t BLOCK_IDB = 0x00000001; ///< Interface Description Block
+    static const uint32_t BLOCK_EPB = 0x00000006; ///< Enhanced Packet Block
+    static const uint16_t LINKTYPE_RAW = 101; ///< Raw IPv4/IPv6, no link layer header
+    static const uint16_t OPT_ENDOFOPT = 0; ///< Last option
+    static const uint16_t OPT_COMMENT = 1; ///< UTF-8 comment
+    static const uint16_t IF_NAME = 2; ///< Name of the interface
+    static const uint16_t IF_TSRESOL = 9; ///< Timestamp resolution
+
+    std::unique_ptr<AsyncWriter> writer; ///< Writer of the capture file
+    unsigned long long captured; ///< Packets handed to the writer
+
+public:
+
+    /** @brief Creates capture file @p path with an interface per process
+     *         of @p network, exits on failure
+     *
+     * @param path File to be written
+     * @param network Network of the emulation
+     */
+    PcapCapture(const std::string& path, const Network& network);
+
+    /** @brief Captures @p packet sent by @p src
+     *
+     * @param packet Packet, as it should appear in the capture
+     * @param src Sending process
+     * @param dest Receiving process
+     * @param send_ts Virtual time packet was sent at (ns)
+     * @param delivery_ts Virtual time packet is delivered at (ns, -1 if dropped)
+     */
+    void capture(const Packet& packet, int src, int dest, long long send_ts, long long delivery_ts);
+
+    /** @brief Print number of captured and dropped packets
+     */
+    void print_stats() const;
+
+private:
+
+    /** @brief Get length of option or packet data padded to 32 bits */
+    static uint32_t padded(uint32_t len);
+
+    /** @brief Writes Interface Description Block named @p name
+     */
+    void write_interface(const std::string& name);
+
+};
+
+PcapCapture::PcapCapture(const std::string& path, const Network& network): captured(0) {
+    struct {
+        uint32_t type, total_len, magic;
+        uint16_t major, minor;
+        int64_t section_len;
+        uint32_t total_len_end;
+    } __attribute__((packed)) shb = {BLOCK_SHB, sizeof(shb), 0x1A2B3C4D, 1, 0, -1, sizeof(shb)};
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        panic(("open " + path).c_str());
+
+    writer.reset(new AsyncWriter(fd, RING_SIZE, true));
+    writer->append(&shb, sizeof(shb));
+    for (int em_id = 0; em_id < network.get_procs(); ++em_id)
+        write_interface("node" + std::to_string(em_id) + " " + network.get_addr(em_id));
+}
+
+void PcapCapture::capture(const Packet& packet, int src, int dest, long long send_ts, long long delivery_ts) {
+    struct {
+        uint32_t type, total_len, interface, ts_high, ts_low, captured_len, original_len;
+    } header;
+    struct {
+        uint16_t code, len;
+        char text[COMMENT_SIZE];
+    } comment;
+    struct {
+        uint16_t code, len;
+        uint32_t total_len;
+    } end = {OPT_ENDOFOPT, 0, 0};
+    static const char zeros[4] = {0};
+    uint32_t data_len = packet.get_size();
+    uint32_t comment_len, comment_padded;
+
+    if (delivery_ts < 0)
+        comment_len = snprintf(comment.text, sizeof(comment.text), "to node%d dropped", dest);
+    else
+        comment_len = snprintf(comment.text, sizeof(comment.text), "to node%d delivered %lld ns",
+            dest, delivery_ts);
+    comment_padded = padded(comment_len);
+    memset(comment.text + comment_len, 0, comment_padded - comment_len);
+    comment.code = OPT_COMMENT;
+    comment.len = comment_len;
+
+    header.type = BLOCK_EPB;
+    header.total_len = sizeof(header) + padded(data_len) + 4 + comment_padded + sizeof(end);
+    header.interface = src;
+    header.ts_high = (uint64_t)send_ts >> 32;
+    header.ts_low = (uint32_t)send_ts;
+    header.captured_len = data_len;
+    header.original_len = data_len;
+    end.total_len = header.total_len;
+
+    struct iovec parts[] = {
+        {&header, sizeof(header)},
+        {packet.get_buffer(), data_len},
+        {const_cast<char*>(zeros), padded(data_len) - data_len},
+        {&comment, 4 + comment_padded},
+        {&end, sizeof(end)}
+    };
+    if (writer->append(parts, (int)(sizeof(parts) / sizeof(parts[0]))))
+        captured++;
+}
+
+void PcapCapture::print_stats() const {
+    char buf[BUF_SIZE];
+
+    snprintf(buf, sizeof(buf), "Capture: %llu packets written, %llu dropped (buffer full)\n",
+        captured, writer->get_dropped());
+    Logger::print_string_safe(buf);
+    LOG(INFO, PACKET, "%s", buf);
+}
+
+/* PRIVATE METHODS */
+
+uint32_t PcapCapture::padded(uint32_t len) {
+    return (len + 3) & ~3u;
+}
+
+void PcapCapture::write_interface(const std::string& name) {
+    struct {
+        uint32_t type, total_len;
+        uint16_t link_type, reserved;
+        uint32_t snap_len;
+    } header = {BLOCK_IDB, 0, LINKTYPE_RAW, 0, 0};
+    struct {
+        uint16_t code, len;
+        uint8_t value;
+        uint8_t pad[3];
+        uint16_t end_code, end_len;
+        uint32_t total_len;
+    } trailer = {IF_TSRESOL, 1, 9 /* 10^-9 s */, {0}, OPT_ENDOFOPT, 0, 0};
+    uint16_t name_option[2] = {IF_NAME, (uint16_t)name.size()};
+    static const char zeros[4] = {0};
+
+    header.total_len = sizeof(header) + sizeof(name_option) + padded(name.size()) + sizeof(trailer);
+    trailer.total_len = header.total_len;
+
+    struct iovec parts[] = {
+        {&header, sizeof(header)},
+        {name_option, sizeof(name_option)},
+        {const_cast<char*>(name.data()), name.size()},
+        {const_cast<char*>(zeros), padded(name.size()) - name.size()},
+        {&trailer, sizeof(trailer)}
+    };
+    writer->append(parts, (int)(sizeof(parts) / sizeof(parts[0])));
+}
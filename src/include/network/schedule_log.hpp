@@ -0,0 +1,207 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+#include "utils.hpp"
+#include "logger.hpp"
+#include "async_writer.hpp"
+
+#define SCHEDULE_LOG_MAGIC "TINYEMRS" ///< First 8 bytes of a schedule log
+#define SCHEDULE_LOG_VERSION 1 ///< Version of schedule log layout
+
+/** @brief Header of a schedule log, followed by @ref ScheduleRecord s */
+struct ScheduleLogHeader {
+    char magic[8]; ///< SCHEDULE_LOG_MAGIC, without NUL
+    uint32_t version; ///< SCHEDULE_LOG_VERSION
+    uint32_t procs; ///< Number of processes of the recorded run
+};
+
+/** @brief Routing decision about a single packet */
+struct ScheduleRecord {
+    int64_t send_ts; ///< Virtual time packet was sent at (ns)
+    int64_t delivery_ts; ///< Virtual time packet is delivered at (ns), -1 if dropped
+    int32_t src; ///< Sending process
+    int32_t dest; ///< Receiving process
+    uint32_t size; ///< Size of the packet in bytes
+    uint32_t reserved; ///< Padding, 0
+};
+
+/** @brief Writes delivery schedule of a run to a binary log
+ *
+ * Records go through an @ref AsyncWriter (waiting when its ring is
+ * full, a log with holes could not be replayed), so scheduling packets
+ * only costs a copy of 32 bytes.
+ */
+class ScheduleRecorder {
+
+    static const size_t RING_SIZE = 4 * 1024 * 1024; ///< Bytes buffered before the producer waits
+
+    std::unique_ptr<AsyncWriter> writer; ///< Writer of the log file
+    unsigned long long records; ///< Records written
+
+public:
+
+    /** @brief Creates log file @p path, exits on failure
+     *
+     * @param path File to be written
+     * @param procs Number of processes in the emulation
+     */
+    ScheduleRecorder(const std::string& path, int procs);
+
+    /** @brief Records that packet of @p size bytes sent from @p src at
+     *         @p send_ts is delivered to @p dest at @p delivery_ts
+     */
+    void record(long long send_ts, int src, int dest, size_t size, long long delivery_ts);
+
+    /** @brief Print number of recorded packets
+     */
+    void print_stats() const;
+
+};
+
+/** @brief Enforces the delivery schedule of a recorded run
+ *
+ * The k-th packet routed from src to dest gets the delivery time (or
+ * the drop) of the k-th recorded packet of that pair, so every process
+ * receives the same packets in the same order at the same virtual
+ * times. Packets beyond the recording, of a different size than
+ * recorded, or whose recorded delivery is earlier than the network
+ * latency allows (which would break the lookahead), keep their computed
+ * times and are counted as divergent.
+ */
+class ScheduleReplayer {
+
+    std::unordered_map<uint64_t, std::deque<ScheduleRecord>> links; ///< Remaining records of every (src, dest)
+    unsigned long long replayed; ///< Packets which got recorded schedule
+    unsigned long long diverged; ///< Packets not matching the recording
+
+public:
+
+    /** @brief Reads log @p path, exits if it's not a valid log for @p procs processes
+     *
+     * @param path Schedule log written by @ref ScheduleRecorder
+     * @param procs Number of processes in the emulation
+     */
+    ScheduleReplayer(const std::string& path, int procs);
+
+    /** @brief Get the delivery time of a packet from the recording
+     *
+     * @param send_ts Virtual time packet was sent at (ns)
+     * @param src Sending process
+     * @param dest Receiving process
+     * @param size Size of the packet in bytes
+     * @param latency Latency from @p src to @p dest (ns)
+     * @param computed Delivery time computed in this run (ns, -1 if dropped)
+     * @return Delivery time in nanoseconds, -1 if the packet is to be dropped
+     */
+    long long delivery(long long send_ts, int src, int dest, size_t size, 
+                       long long latency, long long computed);
+
+    /** @brief Print number of replayed and divergent packets
+     */
+    void print_stats() const;
+
+};
+
+ScheduleRecorder::ScheduleRecorder(const std::string& path, int procs): records(0) {
+    ScheduleLogHeader header;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        panic(("open " + path).c_str());
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCHEDULE_LOG_MAGIC, sizeof(header.magic));
+    header.version = SCHEDULE_LOG_VERSION;
+    header.procs = procs;
+
+    writer.reset(new AsyncWriter(fd, RING_SIZE, false));
+    writer->append(&header, sizeof(header));
+}
+
+void ScheduleRecorder::record(long long send_ts, int src, int dest, size_t size, long long delivery_ts) {
+    ScheduleRecord record = {send_ts, delivery_ts, src, dest, (uint32_t)size, 0};
+
+    writer->append(&record, sizeof(record));
+    records++;
+}
+
+void ScheduleRecorder::print_stats() const {
+    char buf[BUF_SIZE];
+
+    snprintf(buf, sizeof(buf), "Schedule recorded: %llu packets (%llu waits for log buffer)\n",
+        records, writer->get_waits());
+    Logger::print_string_safe(buf);
+    LOG(INFO, PACKET, "%s", buf);
+}
+
+ScheduleReplayer::ScheduleReplayer(const std::string& path, int procs): replayed(0), diverged(0) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0)
+        panic(("open " + path).c_str());
+
+    size_t size = st.st_size;
+    const ScheduleLogHeader* header = nullptr;
+    void* mapping = size >= sizeof(ScheduleLogHeader) ?
+        mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping != MAP_FAILED)
+        header = (const ScheduleLogHeader*)mapping;
+
+    if (!header || memcmp(header->magic, SCHEDULE_LOG_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != SCHEDULE_LOG_VERSION || (int)header->procs != procs) {
+        std::cout << "INVALID SCHEDULE LOG (" << path << ") FOR " << procs << " PROCESSES" << std::endl;
+        exit(1);
+    }
+
+    const ScheduleRecord* records = (const ScheduleRecord*)(header + 1);
+    size_t count = (size - sizeof(ScheduleLogHeader)) / sizeof(ScheduleRecord);
+    for (size_t i = 0; i < count; ++i)
+        links[(uint64_t)records[i].src << 32 | (uint32_t)records[i].dest].push_back(records[i]);
+
+    munmap(mapping, size);
+}
+
+long long ScheduleReplayer::delivery(long long send_ts, int src, int dest, size_t size, 
+                                     long long latency, long long computed) {
+    auto it = links.find((uint64_t)src << 32 | (uint32_t)dest);
+
+    if (it == links.end() || it->second.empty()) {
+        diverged++;
+        return computed;
+    }
+
+    ScheduleRecord record = it->second.front();
+    it->second.pop_front();
+    if (record.size != size || (record.delivery_ts >= 0 && record.delivery_ts < send_ts + latency)) {
+        diverged++; /* Different packet, or recorded delivery before receiver's safe point */
+        return computed;
+    }
+    replayed++;
+    return record.delivery_ts;
+}
+
+void ScheduleReplayer::print_stats() const {
+    char buf[BUF_SIZE];
+    size_t left = 0;
+
+    for (const auto& link: links)
+        left += link.second.size();
+    snprintf(buf, sizeof(buf), "Schedule replayed: %llu packets, %llu diverged, %zu recorded not seen\n",
+        replayed, diverged, left);
+    Logger::print_string_safe(buf);
+    LOG(INFO, PACKET, "%s", buf);
+}
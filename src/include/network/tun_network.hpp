@@ -0,0 +1,350 @@
+#pragma once
+
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include "packet.hpp"
+#include "io_uring.hpp"
+#include "network.hpp"
+#include "config-parser.hpp"
+#include "logger.hpp"
+
+/** @brief Network backend talking to real processes through a TUN interface
+ * 
+ * Class builds and interacts with TUN interface. It sets all necessary 
+ * interface settings and allows to send and receive packets through 
+ * TUN file descriptor.
+ * 
+ * TUN I/O either goes through plain `read`/`write` syscalls, or through 
+ * an io_uring which keeps @ref URING_READS reads posted at all times
+ * and submits queued deliveries in batches (see @ref flush).
+*/
+class TunNetwork : public Network {
+
+    static const int URING_READS = 32; ///< Reads kept posted on the io_uring
+    static const int URING_WRITES = 64; ///< Write buffers available to the io_uring
+    static const uint64_t URING_WRITE_TAG = 1ULL << 63; ///< user_data bit marking writes
+
+    int tun_fd; ///< FD of the TUN interface
+
+    std::unique_ptr<IoUring> ring; ///< io_uring used for TUN I/O (nullptr for syscalls)
+    std::vector<char*> read_slots; ///< Pool slots of posted reads
+    std::deque<std::pair<int, ssize_t>> ready_reads; ///< Completed reads (read index, size)
+    std::vector<char*> write_slots; ///< Pool slots of packets being written (nullptr if free)
+    std::vector<int> free_writes; ///< Indices of write_slots not in flight
+
+    unsigned long long io_syscalls; ///< read/write syscalls made (without io_uring)
+
+public:
+
+    /** @brief Build TUN interface and set necessary constants
+     * 
+     * If @p use_io_uring is set but io_uring can't be set up, falls
+     * back to plain syscalls.
+     * 
+     * @param cp Emulator's configuration read from a file 
+     * @param use_io_uring Whether to do TUN I/O through io_uring
+     */
+    TunNetwork(const ConfigParser& cp, bool use_io_uring = false);
+
+    /** @brief Get FD to poll for incoming packets
+     * 
+     * @return TUN FD, or io_uring FD when TUN I/O goes through io_uring
+     */
+    int get_fd() const override;
+
+    /** @brief Send the buffer of @p packet object through TUN FD
+     * 
+     * With io_uring the write is only queued, see @ref flush. The packet's 
+     * pool slot is then kept until the write completes, so the frame 
+     * is never copied.
+     * 
+     * @param packet Packet which will be sent (consumed)
+     */
+    void send(Packet&& packet) override;
+
+    /** @brief Submit all sends queued since last flush in one syscall
+     * 
+     * Does nothing without io_uring, where every send is written at once.
+     */
+    void flush() override;
+
+    /** @brief Receive data through TUN FD
+     * 
+     * Data is read straight into the pool slot of @p packet (without
+     * io_uring), or the slot the io_uring read into is handed over to it.
+     * 
+     * @param packet Empty packet whose buffer will hold received data
+     * @return Number of received bytes (0 or -1 with EAGAIN if none)
+     */
+    ssize_t receive(Packet& packet) override;
+
+    /** @brief Print and log counters of TUN I/O, including packets per syscall
+     */
+    void print_stats() const override;
+
+    /** @brief Creates and customizes a TUN interface and its subnetwork
+     *         in the network namespace of the calling thread
+     * 
+     * @param name Device name of the interface
+     * @param addr Address of the interface (number/dot form)
+     * @param mask Mask of the subnetwork (number/dot form)
+     * @return Non-blocking FD of the interface
+     */
+    static int create_tun(const std::string& name, const std::string& addr, 
+                          const std::string& mask);
+
+private:
+
+    /** @brief Sets up io_uring and posts all reads, returns false on failure
+     */
+    bool setup_io_uring();
+
+    /** @brief Queues a read into read slot @p index
+     */
+    void post_read(int index);
+
+    /** @brief Consumes all available io_uring completions
+     */
+    void reap_completions();
+
+};
+
+TunNetwork::TunNetwork(const ConfigParser& cp, bool use_io_uring): Network(cp), 
+        io_syscalls(0) {
+    tun_fd = create_tun(cp.tun_dev_name, cp.tun_addr, cp.tun_mask);
+
+    if (use_io_uring && !setup_io_uring())
+        Logger::print_string_safe("[WARNING] io_uring unavailable, using read/write\n");
+
+    // for (int i = 0; i < cp.procs; ++i) {
+    //     printf("[Network.hpp] em_id: %d, addr: %s\n", i, get_addr(i).c_str());
+    // }
+}
+
+int TunNetwork::get_fd() const {
+    return ring ? ring->get_fd() : tun_fd;
+}
+
+void TunNetwork::send(Packet&& packet) {
+    ssize_t ssize;
+    size_t to_send = packet.get_size(), offset = 0;
+
+    LOG_RECORD(TRACE, NETWORK, LogEvent::TUN_SEND, 
+        packet.get_source_in_addr(), packet.get_source_port_tcp(), 
+        packet.get_dest_in_addr(), packet.get_dest_port_tcp());
+    // printf("Packet send from %s.%d to %s.%d\n", 
+    //     packet.get_source_addr().c_str(), packet.get_source_port_tcp(), 
+    //     packet.get_dest_addr().c_str(), packet.get_dest_port_tcp());
+
+    packets_sent++;
+    if (ring) {
+        struct io_uring_sqe* sqe;
+
+        while (free_writes.empty() || (sqe = ring->get_sqe()) == nullptr) {
+            ring->submit(1); /* Wait for something in flight to complete */
+            reap_completions();
+        }
+        int index = free_writes.back();
+        free_writes.pop_back();
+
+        write_slots[index] = packet.swap_buffer(nullptr);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = tun_fd;
+        sqe->addr = (uint64_t)write_slots[index];
+        sqe->len = to_send;
+        sqe->off = -1;
+        sqe->user_data = URING_WRITE_TAG | index;
+        to_send = 0;
+    }
+
+	while (to_send > 0) {
+		ssize = write(tun_fd, packet.get_buffer() + offset, to_send);
+		io_syscalls++;
+		if (ssize < 0)
+			panic("write");
+
+		offset += (size_t) ssize;
+		to_send -= (size_t) ssize;
+	}
+}
+
+void TunNetwork::flush() {
+    if (ring)
+        ring->submit();
+}
+
+ssize_t TunNetwork::receive(Packet& packet) {
+    ssize_t ssize;
+
+    if (ring) {
+        if (ready_reads.empty()) {
+            ring->submit(); /* Repost consumed reads */
+            reap_completions();
+        }
+        if (ready_reads.empty()) {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        int index = ready_reads.front().first;
+        ssize = ready_reads.front().second;
+        ready_reads.pop_front();
+
+        read_slots[index] = packet.swap_buffer(read_slots[index]);
+        packet.set_size(ssize);
+        post_read(index);
+        packets_received++;
+        return ssize;
+    }
+
+    ssize = read(tun_fd, packet.get_buffer(), PacketPool::SLOT_SIZE);
+    io_syscalls++;
+    if (ssize < 0 && errno != EAGAIN)
+        panic("read");
+    if (ssize > 0) {
+        packet.set_size(ssize);
+        packets_received++;
+    }
+    return ssize;
+}
+
+void TunNetwork::print_stats() const {
+    unsigned long long syscalls = ring ? ring->get_enter_calls() : io_syscalls;
+    double per_syscall = syscalls ? 
+        (double)(packets_received + packets_sent) / syscalls : 0.0;
+    char buf[BUF_SIZE];
+
+    snprintf(buf, sizeof(buf), 
+        "Network (%s): %llu packets received, %llu sent, %llu syscalls, %.2f packets per syscall\n",
+        ring ? "io_uring" : "read/write", packets_received, packets_sent, syscalls, per_syscall);
+    Logger::print_string_safe(buf);
+    LOG(INFO, NETWORK, "%s", buf);
+}
+
+int TunNetwork::create_tun(const std::string& name, const std::string& addr, 
+                           const std::string& mask) {
+	static const char clonedev[] = "/dev/net/tun";
+	struct sockaddr_in sin;
+	struct ifreq ifr;
+	int tun_fd, ifd;
+    char inter[IFNAMSIZ];
+    strncpy(inter, name.c_str(), IFNAMSIZ - 1);
+    inter[IFNAMSIZ - 1] = '\0';
+
+	tun_fd = open(clonedev, O_RDWR | O_CLOEXEC);
+	if (tun_fd < 0)
+		panic("open");
+
+	memset(&ifr, 0, sizeof (ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+	strncpy(ifr.ifr_name, inter, IFNAMSIZ);
+
+	if (ioctl(tun_fd, TUNSETIFF, &ifr) < 0)
+		panic("ioctl(TUNSETIFF)");
+
+	strncpy(inter, ifr.ifr_name, IFNAMSIZ);
+
+	memset(&ifr, 0, sizeof (ifr));
+	strncpy(ifr.ifr_name, inter, IFNAMSIZ);
+	ifr.ifr_flags =
+		(short) (IFF_UP | IFF_BROADCAST | IFF_MULTICAST | IFF_DYNAMIC);
+
+	ifd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+	if (ifd < 0)
+		panic("socket");
+
+	if (ioctl(ifd, SIOCSIFFLAGS, &ifr) < 0)
+		panic("ioctl(SIOCSIFFLAGS)");
+
+	sin.sin_family = AF_INET;
+	inet_pton(AF_INET, addr.c_str(), &sin.sin_addr);
+	memset(&ifr, 0, sizeof (ifr));
+	strncpy(ifr.ifr_name, inter, IFNAMSIZ);
+	ifr.ifr_addr = *(struct sockaddr *) &sin;
+
+	if (ioctl(ifd, SIOCSIFADDR, &ifr) < 0)
+		panic("ioctl(SIOCSIFADDR)");
+
+	sin.sin_family = AF_INET;
+	inet_pton(AF_INET, mask.c_str(), &sin.sin_addr);
+	memset(&ifr, 0, sizeof (ifr));
+	strncpy(ifr.ifr_name, inter, IFNAMSIZ);
+	ifr.ifr_netmask = *(struct sockaddr *) &sin;
+
+	if (ioctl(ifd, SIOCSIFNETMASK, &ifr) < 0)
+		panic("ioctl(SIOCSIFNETMASK)");
+	close(ifd);
+
+	/* Setting the tun_fd to have non-blocking read */
+	int flags = fcntl(tun_fd, F_GETFL, 0);
+	fcntl(tun_fd, F_SETFL, flags | O_NONBLOCK);
+	return tun_fd;
+}
+
+bool TunNetwork::setup_io_uring() {
+    ring.reset(new IoUring(2 * (URING_READS + URING_WRITES)));
+    if (!ring->ok()) {
+        ring.reset();
+        return false;
+    }
+
+    /* Posted reads must wait for data instead of failing with EAGAIN */
+    int flags = fcntl(tun_fd, F_GETFL, 0);
+    fcntl(tun_fd, F_SETFL, flags & ~O_NONBLOCK);
+
+    write_slots.assign(URING_WRITES, nullptr);
+    for (int index = 0; index < URING_WRITES; ++index)
+        free_writes.push_back(index);
+    for (int index = 0; index < URING_READS; ++index) {
+        read_slots.push_back(PacketPool::instance().acquire());
+        post_read(index);
+    }
+    ring->submit();
+    return true;
+}
+
+void TunNetwork::post_read(int index) {
+    struct io_uring_sqe* sqe = ring->get_sqe();
+    if (sqe == nullptr)
+        panic("io_uring submission queue full");
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = tun_fd;
+    sqe->addr = (uint64_t)read_slots[index];
+    sqe->len = PacketPool::SLOT_SIZE;
+    sqe->off = -1;
+    sqe->user_data = index;
+}
+
+void TunNetwork::reap_completions() {
+    ring->reap([this](uint64_t user_data, int res) {
+        if (user_data & URING_WRITE_TAG) {
+            if (res < 0) {
+                errno = -res;
+                panic("io_uring write");
+            }
+            int index = user_data & ~URING_WRITE_TAG;
+            PacketPool::instance().release(write_slots[index]);
+            write_slots[index] = nullptr;
+            free_writes.push_back(index);
+            return;
+        }
+
+        if (res > 0) 
+            ready_reads.emplace_back(user_data, res);
+        else if (res == 0 || res == -EAGAIN || res == -EINTR)
+            post_read(user_data);
+        else {
+            errno = -res;
+            panic("io_uring read");
+        }
+    });
+}
\ No newline at end of file
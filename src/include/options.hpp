@@ -0,0 +1,298 @@
+#pragma once
+
+#include <getopt.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "config-parser.hpp"
+#include "log_levels.hpp"
+#include "proc_control/proc_clock.hpp"
+#include "proc_control/quantum_policy.hpp"
+
+/** @brief Class parsing and saving the command line options of tinyem
+ *
+ * Usage: `./tinyem [options] [config_file]`. Positional config path
+ * defaults to @ref CONFIG_PATH.
+ */
+class Options {
+
+public:
+
+    /** @brief Parses @p argv, exits with usage message on error
+     *
+     * @param argc Number of arguments
+     * @param argv Arguments as passed to main
+     */
+    Options(int argc, const char** argv);
+
+    std::string config_path; ///< Path to configuration file
+    bool epochs; ///< Run processes concurrently in epochs below the lookahead horizon
+    bool io_uring; ///< Do TUN I/O through io_uring instead of read/write
+    bool hugepages; ///< Back packet pool with hugepages
+    long long steps; ///< Number of awakenings to perform (-1 if unlimited)
+    long long horizon; ///< Virtual time (ns) at which to stop (-1 if none)
+    long long wall_budget; ///< Real time (ns) after which to stop (-1 if none)
+    bool until_exit; ///< Run until all processes exit (no default step limit)
+    ClockMode clock_mode; ///< How virtual clocks of processes advance
+    long long min_quantum; ///< Shortest quantum (ns)
+    long long max_overrun; ///< Longest extension past safe window (ns, -1 if unlimited)
+    int batch; ///< Maximal windows a process may run in one awakening
+    bool freezer; ///< Stop processes by freezing their cgroups instead of signals
+    std::vector<std::string> env; ///< Environment overrides ("KEY=VALUE") of emulated programs
+    std::string record_path; ///< File to record delivery schedule to (empty if none)
+    std::string replay_path; ///< File to replay delivery schedule from (empty if none)
+    std::string capture_path; ///< pcapng file to capture routed packets to (empty if none)
+    std::string event_log_path; ///< Binary event log written in background (empty if none)
+    int log_level; ///< Lowest LOG_LEVEL_* logged at runtime
+    std::string stats_name; ///< Shared memory object to publish live counters to (empty if none)
+    bool profile; ///< Time phases of the emulation loop and print breakdown
+    long long generate; ///< Packets per second of loopback network (0 if unlimited, -1 for TUN)
+    int payload; ///< Payload of packets generated by loopback network (bytes)
+    bool no_processes; ///< Nodes send generated packets themselves, nothing is spawned
+
+    /** @brief Get the quantum policy described by the options
+     *
+     * @return Quantum policy to be used by the emulator
+     */
+    QuantumPolicy quantum_policy() const;
+
+    /** @brief Prints usage message to stderr
+     *
+     * @param program Name of the executable
+     */
+    static void usage(const char* program);
+
+private:
+
+    /** @brief Parses non-negative integer option argument, exits on error
+     */
+    static long long parse_number(const char* program, const char* arg);
+
+};
+
+Options::Options(int argc, const char** argv):
+        config_path(CONFIG_PATH), epochs(false), io_uring(false),
+        hugepages(false), steps(-2), horizon(-1), wall_budget(-1), 
+        until_exit(false), clock_mode(ClockMode::WALL), min_quantum(0),
+        max_overrun(-1), batch(1), freezer(false), 
+        log_level(LOG_LEVEL_TRACE), profile(false),
+        generate(-1), payload(64), no_processes(false) {
+    static const struct option long_options[] = {
+        {"epochs", no_argument, nullptr, 'e'},
+        {"io-uring", no_argument, nullptr, 'u'},
+        {"hugepages", no_argument, nullptr, 'H'},
+        {"steps", required_argument, nullptr, 's'},
+        {"horizon", required_argument, nullptr, 't'},
+        {"wall-budget", required_argument, nullptr, 'w'},
+        {"until-exit", no_argument, nullptr, 'x'},
+        {"clock", required_argument, nullptr, 'c'},
+        {"min-quantum", required_argument, nullptr, 'q'},
+        {"max-overrun", required_argument, nullptr, 'o'},
+        {"batch", required_argument, nullptr, 'b'},
+        {"freezer", no_argument, nullptr, 'f'},
+        {"env", required_argument, nullptr, 'E'},
+        {"record", required_argument, nullptr, 'R'},
+        {"replay", required_argument, nullptr, 'P'},
+        {"capture", required_argument, nullptr, 'C'},
+        {"event-log", required_argument, nullptr, 'L'},
+        {"log-level", required_argument, nullptr, 'l'},
+        {"stats", required_argument, nullptr, 'S'},
+        {"profile", no_argument, nullptr, 'p'},
+        {"generate", required_argument, nullptr, 'G'},
+        {"payload", required_argument, nullptr, 'Z'},
+        {"no-processes", no_argument, nullptr, 'N'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, const_cast<char* const*>(argv),
+                              "euHs:t:w:xc:q:o:b:fE:R:P:C:L:l:S:pG:Z:Nh", long_options, nullptr)) != -1) {
+        switch (opt) {
+        case 'e':
+            epochs = true;
+            break;
+        case 'u':
+            io_uring = true;
+            break;
+        case 'H':
+            hugepages = true;
+            break;
+        case 's':
+            steps = parse_number(argv[0], optarg);
+            break;
+        case 't':
+            horizon = parse_number(argv[0], optarg) * MILLISECOND;
+            break;
+        case 'w':
+            wall_budget = parse_number(argv[0], optarg) * MILLISECOND;
+            break;
+        case 'x':
+            until_exit = true;
+            break;
+        case 'c':
+            if (std::string(optarg) == "wall")
+                clock_mode = ClockMode::WALL;
+            else if (std::string(optarg) == "cpu")
+                clock_mode = ClockMode::CPU;
+            else {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'q':
+            min_quantum = parse_number(argv[0], optarg) * MICROSECOND;
+            break;
+        case 'o':
+            max_overrun = parse_number(argv[0], optarg) * MICROSECOND;
+            break;
+        case 'b':
+            batch = parse_number(argv[0], optarg);
+            break;
+        case 'f':
+            freezer = true;
+            break;
+        case 'E':
+            if (std::string(optarg).find('=') == std::string::npos) {
+                usage(argv[0]);
+                exit(1);
+            }
+            env.push_back(optarg);
+            break;
+        case 'R':
+            record_path = optarg;
+            break;
+        case 'P':
+            replay_path = optarg;
+            break;
+        case 'C':
+            capture_path = optarg;
+            break;
+        case 'L':
+            event_log_path = optarg;
+            break;
+        case 'l':
+            if (std::string(optarg) == "trace")
+                log_level = LOG_LEVEL_TRACE;
+            else if (std::string(optarg) == "debug")
+                log_level = LOG_LEVEL_DEBUG;
+            else if (std::string(optarg) == "info")
+                log_level = LOG_LEVEL_INFO;
+            else if (std::string(optarg) == "off")
+                log_level = LOG_LEVEL_OFF;
+            else {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'S':
+            stats_name = optarg;
+            if (stats_name[0] != '/')
+                stats_name = "/" + stats_name;
+            break;
+        case 'p':
+            profile = true;
+            break;
+        case 'G':
+            generate = parse_number(argv[0], optarg);
+            break;
+        case 'Z':
+            payload = parse_number(argv[0], optarg);
+            break;
+        case 'N':
+            no_processes = true;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    /* Fixed number of steps only if nothing else tells when to stop */
+    if (steps == -2)
+        steps = (until_exit || horizon >= 0 || wall_budget >= 0) ? -1 : STEPS;
+
+    /* Generated packets aren't sent by the process they're read during */
+    if (no_processes && generate <= 0) {
+        std::cerr << "Nodes without processes (-N) need a packet rate (-G PPS)\n";
+        exit(1);
+    }
+    if (epochs && generate >= 0 && !no_processes) {
+        std::cerr << "Epochs (-e) can't be used with generated traffic (-G)\n";
+        exit(1);
+    }
+
+    if (optind < argc)
+        config_path = argv[optind++];
+    if (optind < argc) {
+        usage(argv[0]);
+        exit(1);
+    }
+}
+
+void Options::usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] (config_file_name_with_extension)\n"
+              << "  -e, --epochs   awaken all processes below the common lookahead\n"
+              << "                 horizon at once, every one in its own network\n"
+              << "                 namespace (needs CAP_SYS_ADMIN)\n"
+              << "  -u, --io-uring batch TUN reads and writes through io_uring\n"
+              << "  -H, --hugepages back packet buffers with hugepages\n"
+              << "  -s, --steps N  stop after N awakenings (default " << STEPS << ",\n"
+              << "                 unlimited if any other stop condition is given)\n"
+              << "  -t, --horizon MS stop when all processes reach virtual time MS\n"
+              << "  -w, --wall-budget MS stop after MS of real time\n"
+              << "  -x, --until-exit run until all processes exit\n"
+              << "  -c, --clock wall|cpu advance virtual clocks by real time (default),\n"
+              << "                 or by real time minus time spent waiting for a CPU\n"
+              << "  -q, --min-quantum US extend shorter windows to US microseconds\n"
+              << "  -o, --max-overrun US never extend a window by more than US\n"
+              << "                 microseconds past the safe one (accuracy knob)\n"
+              << "  -b, --batch N  let a process run up to N maximal windows in one\n"
+              << "                 awakening while nothing can arrive at it\n"
+              << "  -f, --freezer  put every process into its own cgroup (v2) and\n"
+              << "                 freeze it, stopping its whole process tree\n"
+              << "  -E, --env KEY=VALUE set variable in environment of emulated\n"
+              << "                 programs (repeatable, others are inherited)\n"
+              << "  -R, --record FILE write delivery schedule of packets to FILE\n"
+              << "  -P, --replay FILE deliver packets at times recorded in FILE\n"
+              << "                 (same config, see --record)\n"
+              << "  -C, --capture FILE write routed packets to pcapng FILE, stamped\n"
+              << "                 with virtual send times (delivery in comments)\n"
+              << "  -L, --event-log FILE log per-packet events as binary records to\n"
+              << "                 FILE from a background thread (see tinyem-log)\n"
+              << "  -l, --log-level trace|debug|info|off lowest level logged (default\n"
+              << "                 trace, levels below build's minimum are compiled out)\n"
+              << "  -S, --stats NAME publish live counters to shared memory object\n"
+              << "                 NAME (see tinyem-stat)\n"
+              << "  -p, --profile  time phases of the emulation loop, print where\n"
+              << "                 time went and latencies of stopping processes\n"
+              << "  -G, --generate PPS use in-memory loopback network instead of TUN:\n"
+              << "                 running process sends PPS synthetic packets per\n"
+              << "                 second to random processes (0 - as fast as possible)\n"
+              << "  -Z, --payload BYTES payload of generated packets (default 64)\n"
+              << "  -N, --no-processes spawn nothing, with -G every node sends PPS\n"
+              << "                 packets per second of its virtual time itself\n"
+              << "  -h, --help     print this message\n";
+}
+
+QuantumPolicy Options::quantum_policy() const {
+    return QuantumPolicy(min_quantum, max_overrun, batch);
+}
+
+long long Options::parse_number(const char* program, const char* arg) {
+    char* end;
+    long long value = strtoll(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0' || value < 0) {
+        std::cerr << "Invalid number: " << arg << "\n";
+        usage(program);
+        exit(1);
+    }
+    return value;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "utils.hpp"
+
+/** @brief Blocking wait used by the awakening loop instead of busy polling
+ *
+ * Owns an epoll instance watching three descriptors: the TUN FD, a timerfd
+ * armed for the end of the current quantum, and a timerfd armed for the
+ * next delivery deadline from a process' in_packets. Both timers use
+ * absolute CLOCK_MONOTONIC deadlines, the clock the awakening loop
+ * measures elapsed time with.
+ */
+class AwakePoller {
+
+    int epoll_fd; ///< epoll instance watching all descriptors below
+    int quantum_fd; ///< timerfd firing at the end of the quantum
+    int delivery_fd; ///< timerfd firing at the next delivery deadline
+    struct timespec delivery_deadline; ///< Deadline delivery_fd is armed for ({0, 0} if disarmed)
+
+public:
+
+    /** @brief Creates timers and the epoll instance watching them and @p tun_fd
+     *
+     * @param tun_fd FD of the TUN interface
+     */
+    AwakePoller(int tun_fd);
+    ~AwakePoller();
+
+    AwakePoller(const AwakePoller&) = delete;
+    AwakePoller& operator=(const AwakePoller&) = delete;
+
+    /** @brief Arms quantum timer for absolute time @p deadline
+     *
+     * @param deadline CLOCK_MONOTONIC time at which the quantum ends
+     */
+    void arm_quantum(struct timespec deadline);
+
+    /** @brief Arms delivery timer for absolute time @p deadline
+     *
+     * Does nothing if the timer is already armed for @p deadline.
+     *
+     * @param deadline CLOCK_MONOTONIC time at which next packet is due
+     */
+    void arm_delivery(struct timespec deadline);
+
+    /** @brief Disarms delivery timer (nothing left to deliver)
+     */
+    void disarm_delivery();
+
+    /** @brief Blocks until TUN FD is readable or any of the timers fired
+     *
+     * Expired timers are acknowledged, so they don't wake next waits.
+     */
+    void wait();
+
+private:
+
+    void set_timer(int timer_fd, struct timespec deadline);
+
+};
+
+AwakePoller::AwakePoller(int tun_fd): delivery_deadline({0, 0}) {
+    struct epoll_event event;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        panic("epoll_create1");
+
+    quantum_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    delivery_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (quantum_fd < 0 || delivery_fd < 0)
+        panic("timerfd_create");
+
+    for (int fd: {tun_fd, quantum_fd, delivery_fd}) {
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+            panic("epoll_ctl");
+    }
+}
+
+AwakePoller::~AwakePoller() {
+    close(delivery_fd);
+    close(quantum_fd);
+    close(epoll_fd);
+}
+
+void AwakePoller::arm_quantum(struct timespec deadline) {
+    set_timer(quantum_fd, deadline);
+}
+
+void AwakePoller::arm_delivery(struct timespec deadline) {
+    if (deadline.tv_sec == delivery_deadline.tv_sec &&
+            deadline.tv_nsec == delivery_deadline.tv_nsec)
+        return;
+    set_timer(delivery_fd, deadline);
+    delivery_deadline = deadline;
+}
+
+void AwakePoller::disarm_delivery() {
+    if (delivery_deadline.tv_sec == 0 && delivery_deadline.tv_nsec == 0)
+        return;
+    set_timer(delivery_fd, timespec{0, 0});
+    delivery_deadline = timespec{0, 0};
+}
+
+void AwakePoller::wait() {
+    struct epoll_event events[3];
+    uint64_t expirations;
+    int ready;
+
+    do {
+        ready = epoll_wait(epoll_fd, events, 3, -1);
+    } while (ready < 0 && errno == EINTR);
+    if (ready < 0)
+        panic("epoll_wait");
+
+    for (int i = 0; i < ready; ++i) {
+        if (events[i].data.fd == quantum_fd || events[i].data.fd == delivery_fd)
+            read(events[i].data.fd, &expirations, sizeof(expirations));
+        if (events[i].data.fd == delivery_fd)
+            delivery_deadline = timespec{0, 0};
+    }
+}
+
+/* PRIVATE METHODS */
+
+void AwakePoller::set_timer(int timer_fd, struct timespec deadline) {
+    struct itimerspec spec = {{0, 0}, deadline};
+
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+        panic("timerfd_settime");
+}
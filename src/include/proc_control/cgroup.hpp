@@ -0,0 +1,220 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <string>
+#include <fstream>
+#include <sstream>
+
+#include "utils.hpp"
+
+/** @brief A cgroup v2 directory, used to freeze whole process trees
+ *
+ * Creates the directory on construction and removes it on destruction.
+ * All processes (and threads) moved into the cgroup, together with
+ * everything they fork later, are paused and resumed atomically with
+ * `cgroup.freeze`. Completion of a state change is awaited through
+ * `POLLPRI` notifications on `cgroup.events`, so freezing costs the same
+ * for a single process and for a multi-threaded or multi-process node.
+ */
+class Cgroup {
+
+    std::string path; ///< Directory of the cgroup
+    int freeze_fd; ///< FD of `cgroup.freeze`
+    int events_fd; ///< FD of `cgroup.events`
+
+public:
+
+    /** @brief Get the cgroup v2 directory of the calling process
+     *
+     * Looks for the cgroup2 mount in `/proc/self/mounts` and the
+     * process' own cgroup in `/proc/self/cgroup`.
+     *
+     * @return Path of the directory, empty if cgroup v2 is not mounted
+     */
+    static std::string self_path();
+
+    /** @brief Creates cgroup directory @p path, panics on failure
+     *
+     * @param path Directory to be created
+     */
+    Cgroup(const std::string& path);
+
+    /** @brief Removes the directory, which has to be empty by then
+     */
+    ~Cgroup();
+
+    Cgroup(const Cgroup&) = delete;
+    Cgroup& operator=(const Cgroup&) = delete;
+
+    const std::string& get_path() const;
+
+    /** @brief Moves process @p pid with all its threads into the cgroup
+     *
+     * @param pid Process to be moved
+     */
+    void add(int pid);
+
+    /** @brief Freezes the cgroup, returns when all its tasks are frozen
+     */
+    void freeze();
+
+    /** @brief Thaws the cgroup, returns when its tasks may run again
+     */
+    void thaw();
+
+    /** @brief Checks if any process is left in the cgroup
+     *
+     * @return Value of `populated` in `cgroup.events`
+     */
+    bool is_populated();
+
+    /** @brief Kills all processes in the cgroup
+     *
+     * Uses `cgroup.kill` (SIGKILL to every process in the cgroup),
+     * doesn't wait for them to exit, see @ref wait_empty.
+     */
+    void kill();
+
+    /** @brief Returns when no process is left in the cgroup
+     */
+    void wait_empty();
+
+private:
+
+    /** @brief Writes @p value to file @p name of the cgroup
+     */
+    void write_file(const char* name, const std::string& value);
+
+    /** @brief Get value of @p key from `cgroup.events` (-1 if missing)
+     */
+    int read_event(const char* key);
+
+    /** @brief Waits until @p key in `cgroup.events` equals @p value
+     */
+    void wait_event(const char* key, int value);
+
+};
+
+std::string Cgroup::self_path() {
+    std::ifstream mounts("/proc/self/mounts");
+    std::ifstream cgroups("/proc/self/cgroup");
+    std::string line, device, mount_point, fstype, own;
+
+    while (std::getline(mounts, line)) {
+        std::istringstream fields(line);
+        fields >> device >> mount_point >> fstype;
+        if (fstype == "cgroup2")
+            break;
+        mount_point.clear();
+    }
+    if (mount_point.empty())
+        return "";
+
+    while (std::getline(cgroups, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            own = line.substr(3);
+            break;
+        }
+    }
+    if (own == "/")
+        own.clear();
+    return mount_point + own;
+}
+
+Cgroup::Cgroup(const std::string& path): path(path) {
+    if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST)
+        panic(("mkdir " + path).c_str());
+
+    freeze_fd = open((path + "/cgroup.freeze").c_str(), O_WRONLY | O_CLOEXEC);
+    events_fd = open((path + "/cgroup.events").c_str(), O_RDONLY | O_CLOEXEC);
+    if (freeze_fd < 0 || events_fd < 0)
+        panic("open cgroup files");
+}
+
+Cgroup::~Cgroup() {
+    close(events_fd);
+    close(freeze_fd);
+    if (rmdir(path.c_str()) < 0)
+        perror(("rmdir " + path).c_str());
+}
+
+const std::string& Cgroup::get_path() const {
+    return path;
+}
+
+void Cgroup::add(int pid) {
+    write_file("cgroup.procs", std::to_string(pid));
+}
+
+void Cgroup::freeze() {
+    if (pwrite(freeze_fd, "1", 1, 0) < 0)
+        panic("write cgroup.freeze");
+    wait_event("frozen", 1);
+}
+
+void Cgroup::thaw() {
+    if (pwrite(freeze_fd, "0", 1, 0) < 0)
+        panic("write cgroup.freeze");
+    wait_event("frozen", 0);
+}
+
+bool Cgroup::is_populated() {
+    return read_event("populated") == 1;
+}
+
+void Cgroup::kill() {
+    write_file("cgroup.kill", "1");
+}
+
+void Cgroup::wait_empty() {
+    wait_event("populated", 0);
+}
+
+/* PRIVATE METHODS */
+
+void Cgroup::write_file(const char* name, const std::string& value) {
+    std::string file = path + "/" + name;
+    int fd = open(file.c_str(), O_WRONLY | O_CLOEXEC);
+
+    if (fd < 0 || write(fd, value.c_str(), value.size()) < 0)
+        panic(("write " + file).c_str());
+    close(fd);
+}
+
+int Cgroup::read_event(const char* key) {
+    char buf[BUF_SIZE];
+    ssize_t size = pread(events_fd, buf, sizeof(buf) - 1, 0);
+    size_t key_len = strlen(key);
+
+    if (size <= 0)
+        return -1;
+    buf[size] = '\0';
+
+    /* Format: one "<key> <value>" pair per line */
+    for (char* line = buf; line && *line; line = strchr(line, '\n')) {
+        if (*line == '\n')
+            line++;
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ')
+            return atoi(line + key_len + 1);
+    }
+    return -1;
+}
+
+void Cgroup::wait_event(const char* key, int value) {
+    struct pollfd pfd = {events_fd, POLLPRI, 0};
+
+    /* Timeout only guards against a missed notification */
+    while (read_event(key) != value) {
+        if (poll(&pfd, 1, 100) < 0 && errno != EINTR)
+            panic("poll cgroup.events");
+    }
+}
@@ -7,14 +7,22 @@
 #include <time.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
 #include <queue>
+#include <memory>
 
 #include "proc_frame.hpp"
+#include "awake_poller.hpp"
+#include "proc_clock.hpp"
+#include "cgroup.hpp"
 #include "logger.hpp"
+#include "stats_page.hpp"
+#include "profiler.hpp"
 
 #include "utils.hpp"
 #include "network/packet.hpp"
+#include "network/packet_queue.hpp"
 #include "network/network.hpp"
 
 /** Type of emulator's internal process id  */
@@ -34,10 +42,15 @@ class EMProc {
 public:
 
     em_id_t em_id; ///< Internal id of emulated process
-    int pid; ///< pid of emulated process
+    int pid; ///< pid of emulated process (-1 if driven by a generator)
     struct timespec virtual_clock; ///< Time that the process was awake
-    std::priority_queue<Packet> out_packets; ///< Buffer of packets sent by process
-    std::priority_queue<Packet> in_packets; ///< Buffer of packets to be received by process
+    bool exited; ///< Whether the process has exited (and was reaped)
+    ProcClock clock; ///< Time process was kept waiting for a CPU (CPU clock mode)
+    std::unique_ptr<Cgroup> cgroup; ///< Cgroup frozen instead of signalling pid (nullptr if not used)
+    PacketQueue out_packets; ///< Buffer of packets sent by process
+    PacketQueue in_packets; ///< Buffer of packets to be received by process
+    ProcStats stats; ///< Counters of packets and quanta, published by emulator
+    bool running; ///< Whether an awakening is in progress
 
     /** @brief Class main constructor
      * 
@@ -45,9 +58,30 @@ public:
      * 
      * @param em_id Emulator's internal process id of this process
      * @param pid Operating systems pid of process associated with this emulated process
+     * @param clock_mode How the virtual clock advances during awakenings
     */
-    EMProc(em_id_t em_id, int pid): em_id(em_id), pid(pid), 
-                                    virtual_clock({0, 0}) {}
+    EMProc(em_id_t em_id, int pid, ClockMode clock_mode = ClockMode::WALL): 
+                                    em_id(em_id), pid(pid), 
+                                    virtual_clock({0, 0}), exited(false),
+                                    clock(pid, clock_mode), stats(),
+                                    running(false), send_period(0), 
+                                    next_send({0, 0}) {}
+
+    /** @brief Creates a node without process, sending generated packets
+     * 
+     * The node sends a packet read from the network (a generator, see
+     * @ref LoopbackNetwork) every @p send_period of its virtual time,
+     * and receives packets delivered to it at once.
+     * 
+     * @param em_id Emulator's internal process id of this node
+     * @param send_period Virtual time between packets sent (ns)
+     * @param first_send Virtual time of the first packet sent (ns)
+    */
+    EMProc(em_id_t em_id, long long send_period, long long first_send): 
+                                    EMProc(em_id, -1) {
+        this->send_period = send_period;
+        this->next_send = ts_from_nano(first_send);
+    }
 
     /** @brief Awake emulated process and let him run for
      *         specified amount of time, intercepting packets sent by it.
@@ -58,20 +92,103 @@ public:
      * in out_packets.
      * 
      * Function sends `SIGCONT` signal to specified process, then after @p ts time
-     * it sends the `SIGSTOP` signal. During the time that the process is running
+     * it sends the `SIGSTOP` signal (or thaws and freezes @ref cgroup of the
+     * process, if it has one). During the time that the process is running
      * all packets sent by it will be intercepted. Also, in appropriate times,
      * packets from in_packets will be sent to the process using 
      * the TUN interface with @p tun_fd . virtual_clock is updated 
      * inside this function. It is guaranteed that when the function
-     * returns, the specified process has already stopped.
+     * returns, the specified process has already stopped, or has exited
+     * and was reaped (then @ref exited is set).
+     * 
+     * Whenever there is nothing to read from the TUN interface, the loop
+     * blocks in @p poller until a packet arrives, the next in_packets 
+     * delivery is due, or the quantum ends.
+     * 
+     * In @ref ClockMode::CPU mode time the process spent waiting for a CPU
+     * is not counted as elapsed, so the quantum, packet timestamps and
+     * delivery deadlines are all shifted by it.
+     * 
+     * A node without process is advanced by @ref generate instead, in
+     * no real time.
      * 
      * @param ts Time for the process to run
      * @param network Network on which the simulator is operating
+     * @param poller Poller watching the TUN FD of @p network
+     */
+    void awake(struct timespec ts, Network& network, AwakePoller& poller);
+
+    /** @brief Lets the process run for @p ts , starting an awakening
+     * 
+     * Steps of @ref awake are available separately, so that the emulator
+     * can run several processes at once (see 
+     * @ref Emulator::start_epoch_emulation), each of them in its own
+     * awakening.
+     * 
+     * @param ts Time for the process to run
+     * @return False if the process is gone (no awakening started)
+     */
+    bool begin_awake(struct timespec ts);
+
+    /** @brief Measures the time elapsed in the current awakening
+     * 
+     * @return Elapsed time, without time stolen in CPU clock mode
+     */
+    struct timespec update_elapsed();
+
+    /** @brief Checks whether the quantum ran out, as of the last
+     *         @ref update_elapsed (records overshoot if it did)
+     */
+    bool quantum_over();
+
+    /** @brief Sends packets from in_packets due by the last 
+     *         @ref update_elapsed to the process through @p network
+     */
+    void deliver_due(Network& network);
+
+    /** @brief Stores packet sent by the process, or counts it as foreign 
+     *         if it isn't sent to an emulated process
+     * 
+     * Packets to the process itself are put into in_packets at once.
+     * 
+     * @param packet Packet read from @p network
+     * @param network Network on which the simulator is operating
+     */
+    void take_sent(Packet&& packet, Network& network);
+
+    /** @brief Get virtual time of the process, including the time 
+     *         elapsed in the current awakening
+     */
+    struct timespec get_virtual_time() const;
+
+    /** @brief Get CLOCK_MONOTONIC time at which the quantum ends
+     */
+    struct timespec get_quantum_deadline() const;
+
+    /** @brief Get CLOCK_MONOTONIC time at which the next packet from 
+     *         in_packets is due
+     * 
+     * @param deadline Set to the deadline, if there is any packet
+     * @return False if in_packets is empty
      */
-    void awake(struct timespec ts, const Network& network);
+    bool get_delivery_deadline(struct timespec& deadline) const;
+
+    /** @brief Stops the process, ending the awakening and advancing 
+     *         virtual_clock by the whole quantum
+     */
+    void end_awake();
 
 private:
 
+    long long send_period; ///< Virtual time between generated packets (ns, node without process)
+    struct timespec next_send; ///< Virtual time of the next generated packet
+
+    struct timespec quantum; ///< Length of the current awakening
+    struct timespec start_time; ///< CLOCK_MONOTONIC time the awakening started at
+    long long start_delay; ///< Run delay of the process when the awakening started
+    struct timespec stolen_time; ///< Time process waited for a CPU during the awakening
+    struct timespec elapsed_time; ///< Time elapsed in the awakening, without stolen_time
+
     /** \brief Check if there is any packet that this process should receive
      *         before the specified timestamp.  
      * 
@@ -83,95 +200,223 @@ private:
      */
     bool to_receive_before(struct timespec ts);
 
+    /** \brief Lets the process (or its whole cgroup) run
+     * 
+     * @return False if the process exited
+     */
+    bool resume();
+
+    /** \brief Stops the process (or freezes its whole cgroup), 
+     *         reaps it if it exited meanwhile
+     */
+    void pause();
+
+    /** \brief Waits until the process reports state change requested by
+     *         @p options (WCONTINUED or WSTOPPED), or exits
+     * 
+     * With WNOHANG it only reaps the process if it has already exited.
+     * 
+     * Uses `waitid` on the process' pid, so exit of the process is noticed
+     * instead of waiting for a `SIGCHLD` which would never come. If the
+     * process exited, it is reaped and @ref exited is set.
+     * 
+     * @param options State change to wait for (waitid options)
+     * @return False if the process exited
+     */
+    bool wait_for_state(int options);
+
+    /** \brief Advances node without process by @p ts
+     * 
+     * Delivers packets from in_packets due within @p ts through 
+     * @p network, and sends a packet read from @p network at every
+     * multiple of @ref send_period within it, stamped with that time.
+     * 
+     * @param ts Virtual time to advance by
+     * @param network Network generating the packets
+     */
+    void generate(struct timespec ts, Network& network);
+
 };
 
-void EMProc::awake(struct timespec ts, const Network& network) {
-    struct timespec start_time, elapsed_time;
+void EMProc::awake(struct timespec ts, Network& network, AwakePoller& poller) {
+    struct timespec deadline, armed = {0, 0};
     ssize_t ssize;
-    char buf[MTU];
-
-    int sig;
-    sigset_t to_block;
-    sigemptyset(&to_block);
-    sigaddset(&to_block, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &to_block, nullptr);
 
-    kill(this->pid, SIGCONT);
-    clock_gettime(CLOCK_MONOTONIC, &start_time);
-    sigwait(&to_block, &sig); 
+    if (pid < 0) {
+        generate(ts, network);
+        return;
+    }
+    if (!begin_awake(ts))
+        return; /* Process is gone */
     while (true) {
-        elapsed_time = get_time_since(start_time);
-
-        if (elapsed_time > ts)
+        update_elapsed();
+        if (quantum_over())
             break; /* Appropriate time run */
         
         /* If anything should be sent to this process in this loop, send it */
-        while (to_receive_before(virtual_clock + elapsed_time)) {
-            logger_ptr->log_event("Sending something at proc time: %ld", nano_from_ts(virtual_clock + elapsed_time));
-
-            network.send(in_packets.top());
-
-            // printf("[emproc.hpp] In_packets: ------- em_id: %d\n", em_id);
-            // Packet packet1 = in_packets.top();
-            // packet1.dump();
-            // printf("  %s -> %s\n", packet1.get_source_addr().c_str(), packet1.get_dest_addr().c_str()); 
-            this->in_packets.pop();
+        deliver_due(network);
+        {
+            ProfileScope scope(Phase::TUN_WRITE);
+            network.flush();
         }
 
         /* If running process sent anything, save it */
-        ssize = network.receive(buf, sizeof(buf));
+        Packet packet(get_virtual_time());
+        {
+            ProfileScope scope(Phase::TUN_READ);
+            ssize = network.receive(packet);
+        }
         if (ssize <= 0) {
-            // printf("[emproc.hpp] NONE RECV!\n");
-            continue; /* Nothing received*/
+            /* Nothing received, sleep until something happens */
+            if (get_quantum_deadline() > armed) {
+                /* Process was kept waiting, quantum ends later in real time */
+                armed = get_quantum_deadline();
+                poller.arm_quantum(armed);
+            }
+            if (get_delivery_deadline(deadline))
+                poller.arm_delivery(deadline);
+            else
+                poller.disarm_delivery();
+            ProfileScope scope(Phase::WAIT);
+            poller.wait();
+            continue;
         }  
 
-        // printf("[emproc.hpp] Received: %s, size: %ld\n", buf, ssize);
-        // dump(buf, ssize);
-
-        Packet packet(buf, ssize, this->virtual_clock + elapsed_time);
+        // printf("[emproc.hpp] Received: %s, size: %ld\n", packet.get_buffer(), ssize);
         // printf("%s(%d) -> %s(%d)\n", packet.get_source_addr().c_str(), packet.get_source_port(), packet.get_dest_addr().c_str(), packet.get_dest_port());
         // packet.dump();
 
-        if (packet.get_version() != 4)
-            continue; /* IP version not supported */
-        if (network.get_em_id(packet.get_dest_addr()) < 0)
-            continue; /* Target not in simulated network */
-        
-        /* Running process sent a valid packet to another process in the system */
+        take_sent(std::move(packet), network);
+    }
 
-        logger_ptr->log_event("Process %d sending packet to process %d (%s), packet length: %d",
-            em_id, network.get_em_id(packet.get_dest_addr()), packet.get_dest_addr().c_str(), ssize);
-        // Here print process!
-        // printf("Process %d sending packet to process %d (%s), packet length: %ld\n", em_id, network.get_em_id(packet.get_dest_addr()), packet.get_dest_addr().c_str(), ssize);
-        // printf("[emproc.hpp]Buffer: %s\n", packet.get_buffer());
+    end_awake();
+}
 
-        // process(packet.get_buffer(), packet.get_size());
+bool EMProc::begin_awake(struct timespec ts) {
+    sigset_t to_block;
+    sigemptyset(&to_block);
+    sigaddset(&to_block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &to_block, nullptr);
 
-        // printf("%s(%d) -> %s(%d)\n", packet.get_source_addr().c_str(), packet.get_source_port_tcp(), packet.get_dest_addr().c_str(), packet.get_dest_port_tcp());
-        // printf("Em_id: %d, Dest:%s (em_id: %d)\n",em_id, packet.get_dest_addr().c_str(), network.get_em_id(packet.get_dest_addr()));
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    if (!resume())
+        return false;
+    start_delay = clock.get_run_delay();
+    quantum = ts;
+    stolen_time = {0, 0};
+    elapsed_time = {0, 0};
+    running = true;
+    return true;
+}
 
-        if (network.get_em_id(packet.get_dest_addr()) == em_id) {
-            /* Packet sent to my own listening socket, receive immidietly */
+struct timespec EMProc::update_elapsed() {
+    stolen_time = ts_from_nano(clock.get_run_delay() - start_delay);
+    elapsed_time = get_time_since(start_time) - stolen_time;
+    return elapsed_time;
+}
 
-            // packet.set_dest_addr(network.get_inter_addr());
-            // packet.set_source_addr(network.get_addr(em_id));
+bool EMProc::quantum_over() {
+    if (!(elapsed_time > quantum))
+        return false;
+    Profiler::instance().record_overshoot(nano_from_ts(elapsed_time - quantum));
+    return true;
+}
 
-            /* Modified from UDP to TCP */
-            packet.set_dest_addr_tcp(network.get_inter_addr());
-            packet.set_source_addr_tcp(network.get_addr(em_id));
+void EMProc::deliver_due(Network& network) {
+    while (to_receive_before(virtual_clock + elapsed_time)) {
+        LOG_RECORD(TRACE, PACKET, LogEvent::PACKET_DELIVERED, em_id, nano_from_ts(virtual_clock + elapsed_time));
 
-            in_packets.push(packet);
-        }
-        else {
-            out_packets.push(packet);
-        }
+        stats.packets_in++;
+        stats.bytes_in += in_packets.top().get_size();
+        ProfileScope scope(Phase::TUN_WRITE);
+        network.send(this->in_packets.pop());
+
+        // printf("[emproc.hpp] In_packets: ------- em_id: %d\n", em_id);
+    }
+}
+
+void EMProc::take_sent(Packet&& packet, Network& network) {
+    if (packet.get_version() != 4) {
+        stats.foreign++;
+        return; /* IP version not supported */
+    }
+    em_id_t dest_em_id = network.get_em_id(packet.get_dest_in_addr());
+    if (dest_em_id < 0) {
+        stats.foreign++;
+        return; /* Target not in simulated network */
     }
+    
+    /* Running process sent a valid packet to another process in the system */
 
+    LOG_RECORD(TRACE, PACKET, LogEvent::PACKET_SENT, em_id, dest_em_id, packet.get_size());
+    stats.packets_out++;
+    stats.bytes_out += packet.get_size();
+    // Here print process!
+    // printf("Process %d sending packet to process %d (%s), packet length: %ld\n", em_id, network.get_em_id(packet.get_dest_addr()), packet.get_dest_addr().c_str(), ssize);
+    // printf("[emproc.hpp]Buffer: %s\n", packet.get_buffer());
 
-    kill(this->pid, SIGSTOP);
-    sigwait(&to_block, &sig);
+    // process(packet.get_buffer(), packet.get_size());
+
+    // printf("%s(%d) -> %s(%d)\n", packet.get_source_addr().c_str(), packet.get_source_port_tcp(), packet.get_dest_addr().c_str(), packet.get_dest_port_tcp());
+    // printf("Em_id: %d, Dest:%s (em_id: %d)\n",em_id, packet.get_dest_addr().c_str(), network.get_em_id(packet.get_dest_addr()));
+
+    if (dest_em_id == em_id) {
+        /* Packet sent to my own listening socket, receive immidietly */
+
+        // packet.set_dest_addr(network.get_inter_addr());
+        // packet.set_source_addr(network.get_addr(em_id));
+
+        /* Modified from UDP to TCP */
+        ProfileScope scope(Phase::REWRITE);
+        packet.rewrite_addrs(network.get_in_addr(em_id), network.get_delivery_in_addr(em_id));
+
+        in_packets.push(std::move(packet));
+    }
+    else {
+        out_packets.push(std::move(packet));
+    }
+}
 
-    this->virtual_clock = this->virtual_clock + ts;
+struct timespec EMProc::get_virtual_time() const {
+    return running ? virtual_clock + elapsed_time : virtual_clock;
+}
+
+struct timespec EMProc::get_quantum_deadline() const {
+    return start_time + stolen_time + quantum;
+}
+
+bool EMProc::get_delivery_deadline(struct timespec& deadline) const {
+    if (in_packets.empty())
+        return false;
+    deadline = start_time + stolen_time + (in_packets.top().get_ts() - virtual_clock);
+    return true;
+}
+
+void EMProc::end_awake() {
+    pause();
+    running = false;
+
+    this->virtual_clock = this->virtual_clock + quantum;
+    stats.quanta++;
+}
+
+void EMProc::generate(struct timespec ts, Network& network) {
+    struct timespec end = virtual_clock + ts;
+
+    running = true;
+    elapsed_time = ts;
+    deliver_due(network);
+    while (send_period > 0 && next_send < end) {
+        Packet packet(next_send);
+        if (network.receive(packet) <= 0)
+            break; /* Generator has nothing to send */
+        take_sent(std::move(packet), network);
+        next_send = next_send + ts_from_nano(send_period);
+    }
+    running = false;
+
+    this->virtual_clock = end;
+    stats.quanta++;
 }
 
 bool EMProc::to_receive_before(struct timespec ts) {
@@ -179,3 +424,49 @@ bool EMProc::to_receive_before(struct timespec ts) {
         return false;
     return in_packets.top().get_ts() < ts;
 }
+
+bool EMProc::resume() {
+    ProfileScope scope(Phase::RESUME, &Profiler::instance().resume_signal);
+
+    if (cgroup) {
+        cgroup->thaw();
+        return true;
+    }
+    kill(this->pid, SIGCONT);
+    return wait_for_state(WCONTINUED);
+}
+
+void EMProc::pause() {
+    ProfileScope scope(Phase::PAUSE, &Profiler::instance().pause_latency);
+
+    if (cgroup) {
+        cgroup->freeze();
+        wait_for_state(WNOHANG); /* Only reap, if it exited */
+        return;
+    }
+    kill(this->pid, SIGSTOP);
+    wait_for_state(WSTOPPED);
+}
+
+bool EMProc::wait_for_state(int options) {
+    siginfo_t info;
+
+    while (true) {
+        info.si_pid = 0;
+        if (waitid(P_PID, this->pid, &info, options | WEXITED) < 0) {
+            if (errno == EINTR)
+                continue;
+            this->exited = true; /* Not our child anymore */
+            return false;
+        }
+        if (info.si_pid == 0)
+            return true; /* WNOHANG, nothing changed */
+        if (info.si_code == CLD_EXITED || info.si_code == CLD_KILLED || 
+                info.si_code == CLD_DUMPED) {
+            LOG(INFO, SCHED, "Process %d (pid %d) exited", em_id, pid);
+            this->exited = true;
+            return false;
+        }
+        return true;
+    }
+}
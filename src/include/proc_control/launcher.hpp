@@ -0,0 +1,180 @@
+#pragma once
+
+#include <spawn.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "utils.hpp"
+#include "logger.hpp"
+
+extern char** environ;
+
+/** @brief Starts emulated programs stopped and reaps them at the end
+ *
+ * Every program is started with `posix_spawnp` (no copy of the
+ * emulator's address space) as
+ * \code{}
+ * sh -c 'kill -STOP $$ && exec program args...'
+ * \endcode
+ * so the shell stops itself under the pid handed to the emulator, and
+ * once continued replaces itself with the program, resolved through
+ * `PATH` (`java` included). Program line is interpreted by the shell,
+ * as config lines rely on its quoting (e.g. a quoted classpath wildcard
+ * passed to `java -cp`). The stop reported by `waitid` is the readiness
+ * handshake: when it returns, the process is known to be stopped and
+ * nothing of the program has run yet.
+ *
+ * Programs get the emulator's environment with configured overrides.
+ */
+class Launcher {
+
+    std::vector<std::string> env; ///< Environment of spawned programs, "KEY=VALUE"
+
+public:
+
+    /** @brief Prepares environment: the emulator's one with @p overrides
+     *
+     * @param overrides Variables ("KEY=VALUE") to be set or replaced
+     */
+    Launcher(const std::vector<std::string>& overrides = {});
+
+    /** @brief Spawns @p path with @p args, stopped before it executes
+     *
+     * Does not wait for the stop, see @ref wait_stopped.
+     *
+     * @param path Program to be run, looked up in `PATH` if it has no '/'
+     * @param args Arguments to be passed to the program
+     * @return pid of the spawned process
+     */
+    int spawn_stopped(const std::string& path, const std::vector<std::string>& args) const;
+
+    /** @brief Waits until process @p pid started by @ref spawn_stopped
+     *         has stopped itself
+     *
+     * @param pid Process to wait for
+     * @return False if it exited instead
+     */
+    static bool wait_stopped(int pid);
+
+    /** @brief Waits for all @p pids to exit at once and reaps them
+     *
+     * Watches pidfds of all processes with a single `poll`. Processes
+     * still alive after @p grace_ms are killed with `SIGKILL`.
+     *
+     * @param pids Processes which were told to exit
+     * @param grace_ms Time they have to exit on their own
+     */
+    static void reap(const std::vector<int>& pids, int grace_ms);
+
+};
+
+Launcher::Launcher(const std::vector<std::string>& overrides) {
+    for (char** var = environ; var && *var; ++var)
+        env.push_back(*var);
+
+    for (const auto& override: overrides) {
+        size_t name_len = override.find('=');
+        bool replaced = false;
+
+        if (name_len == std::string::npos)
+            continue; /* Not a "KEY=VALUE" pair */
+        for (auto& var: env) {
+            if (var.compare(0, name_len + 1, override, 0, name_len + 1) == 0) {
+                var = override;
+                replaced = true;
+            }
+        }
+        if (!replaced)
+            env.push_back(override);
+    }
+}
+
+int Launcher::spawn_stopped(const std::string& path, const std::vector<std::string>& args) const {
+    std::string command = "kill -STOP $$ && exec " + path;
+    std::vector<char*> argv, envp;
+    int pid, error;
+
+    for (const auto& arg: args)
+        command += " " + arg;
+
+    argv.push_back(const_cast<char*>("sh"));
+    argv.push_back(const_cast<char*>("-c"));
+    argv.push_back(const_cast<char*>(command.c_str()));
+    argv.push_back(nullptr);
+
+    for (const auto& var: env)
+        envp.push_back(const_cast<char*>(var.c_str()));
+    envp.push_back(nullptr);
+
+    error = posix_spawnp(&pid, "sh", nullptr, nullptr, argv.data(), envp.data());
+    if (error != 0) {
+        errno = error;
+        panic("posix_spawnp");
+    }
+    return pid;
+}
+
+bool Launcher::wait_stopped(int pid) {
+    siginfo_t info;
+
+    while (waitid(P_PID, pid, &info, WSTOPPED | WEXITED) < 0) {
+        if (errno != EINTR)
+            panic("waitid");
+    }
+    return info.si_code == CLD_STOPPED;
+}
+
+void Launcher::reap(const std::vector<int>& pids, int grace_ms) {
+    std::vector<struct pollfd> pidfds;
+    struct timespec start_time;
+    int wstatus, fd, ready;
+    long long left;
+    bool killed = false;
+
+    for (int pid: pids) {
+        fd = syscall(SYS_pidfd_open, pid, 0);
+        if (fd < 0) {
+            waitpid(pid, &wstatus, 0); /* No pidfds, wait for it alone */
+            continue;
+        }
+        pidfds.push_back({fd, POLLIN, 0});
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (size_t alive = pidfds.size(); alive > 0; ) {
+        left = grace_ms - nano_from_ts(get_time_since(start_time)) / MILLISECOND;
+        ready = poll(pidfds.data(), pidfds.size(), killed ? -1 : std::max(left, 0LL));
+        if (ready < 0 && errno != EINTR)
+            panic("poll pidfds");
+
+        for (auto& pfd: pidfds) {
+            if (pfd.fd < 0)
+                continue;
+            if (pfd.revents & POLLIN) {
+                close(pfd.fd);
+                pfd.fd = -1; /* poll ignores negative FDs */
+                alive--;
+            }
+            else if (ready == 0) {
+                /* Grace period over */
+                syscall(SYS_pidfd_send_signal, pfd.fd, SIGKILL, nullptr, 0);
+            }
+        }
+        if (ready == 0)
+            killed = true;
+    }
+
+    for (int pid: pids) {
+        if (waitpid(pid, &wstatus, 0) == -1 && errno != ECHILD)
+            Logger::print_string_safe("WAITPID FAILED!\n");
+    }
+}
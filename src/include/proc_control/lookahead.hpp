@@ -0,0 +1,140 @@
+#pragma once
+
+#include <limits.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "utils.hpp"
+#include "network/network.hpp"
+#include "proc_control/emproc.hpp"
+#include "proc_control/proc_queue.hpp"
+
+/** @brief Precomputed lookahead used to bound how long a process may run
+ *
+ * A packet can reach process e no earlier than the lowest virtual clock
+ * among the other processes plus the lowest latency of any link into e.
+ * The per-process minimum incoming latency is computed once from the
+ * latency matrix, so together with the clocks kept in @ref ProcQueue the
+ * earliest possible arrival (and hence the safe window) is available
+ * in O(1) instead of a scan over all processes.
+ *
+ * The bound never exceeds the exact pairwise minimum, so the windows
+ * are always safe, at worst somewhat shorter.
+ *
+ * The minimum outgoing latency of every process is kept as well, giving
+ * the horizon of a YAWNS-style epoch: nothing sent by any process after
+ * its current clock can arrive anywhere before that horizon.
+ */
+class Lookahead {
+
+    std::vector<long long> min_in_latency; ///< Lowest latency (ns) of a link into every process
+    std::vector<long long> min_out_latency; ///< Lowest latency (ns) of a link out of every process
+    long long max_window; ///< Upper limit on any window (ns), twice the max latency
+
+public:
+
+    /** @brief Precomputes incoming and outgoing latency minima of every process
+     *
+     * @param network Network whose latencies are used
+     */
+    Lookahead(const Network& network);
+
+    /** @brief Earliest virtual time at which anything may arrive at @p em_id
+     *
+     * @param em_id Process for which to check
+     * @param queue Queue holding virtual clocks of all processes
+     * @return Earliest possible arrival in nanoseconds (LLONG_MAX if none)
+     */
+    long long earliest_arrival(em_id_t em_id, const ProcQueue& queue) const;
+
+    /** @brief Returns the longest time @p em_id can run
+     *         without violating correctness
+     *
+     * @param em_id Process which will be run
+     * @param queue Queue holding virtual clocks of all processes
+     * @param windows How many maximal windows the process may run at once
+     * @return The maximum possible time to run in nanoseconds
+     */
+    long long safe_window(em_id_t em_id, const ProcQueue& queue, int windows = 1) const;
+
+    /** @brief Earliest virtual time at which a packet sent by any process
+     *         from now on may arrive anywhere
+     *
+     * Minimum over queued processes p of
+     * \code{}
+     * p->virtual_clock + min_out_latency(p)
+     * \endcode
+     * capped at the lowest clock plus the maximum window. Every process
+     * whose clock is below the horizon can run up to it independently
+     * of the others. Runs in O(n), once per epoch (@ref Emulator::start_epoch_emulation).
+     *
+     * @param queue Queue holding virtual clocks of all processes
+     * @return Epoch horizon in nanoseconds
+     */
+    long long epoch_horizon(const ProcQueue& queue) const;
+
+    /** @brief Get the upper limit on any window
+     *
+     * @return Twice the maximum latency in nanoseconds
+     */
+    long long get_max_window() const;
+
+    /** @brief Get lowest latency of any link into @p em_id
+     *
+     * @param em_id Process for which to check
+     * @return Minimum incoming latency in nanoseconds (LLONG_MAX if none)
+     */
+    long long get_min_in_latency(em_id_t em_id) const;
+
+};
+
+Lookahead::Lookahead(const Network& network):
+        min_in_latency(network.get_procs(), LLONG_MAX),
+        min_out_latency(network.get_procs(), LLONG_MAX) {
+    int procs = network.get_procs();
+    max_window = 2 * nano_from_ts(network.get_max_latency());
+
+    for (em_id_t src = 0; src < procs; ++src) {
+        for (em_id_t dest = 0; dest < procs; ++dest) {
+            if (src == dest)
+                continue;
+            long long latency = nano_from_ts(network.get_latency(src, dest));
+            min_in_latency[dest] = std::min(min_in_latency[dest], latency);
+            min_out_latency[src] = std::min(min_out_latency[src], latency);
+        }
+    }
+}
+
+long long Lookahead::earliest_arrival(em_id_t em_id, const ProcQueue& queue) const {
+    long long other_clock = queue.min_clock_except(em_id);
+    if (other_clock == LLONG_MAX || min_in_latency[em_id] == LLONG_MAX)
+        return LLONG_MAX;
+    return other_clock + min_in_latency[em_id];
+}
+
+long long Lookahead::safe_window(em_id_t em_id, const ProcQueue& queue, int windows) const {
+    long long arrival = earliest_arrival(em_id, queue);
+    if (arrival == LLONG_MAX)
+        return windows * max_window;
+    return std::min(windows * max_window, arrival - queue.get_clock(em_id));
+}
+
+long long Lookahead::epoch_horizon(const ProcQueue& queue) const {
+    long long horizon = queue.get_clock(queue.top()) + max_window;
+
+    for (em_id_t em_id = 0; em_id < (em_id_t)min_out_latency.size(); ++em_id) {
+        if (!queue.contains(em_id) || min_out_latency[em_id] == LLONG_MAX)
+            continue;
+        horizon = std::min(horizon, queue.get_clock(em_id) + min_out_latency[em_id]);
+    }
+    return horizon;
+}
+
+long long Lookahead::get_max_window() const {
+    return max_window;
+}
+
+long long Lookahead::get_min_in_latency(em_id_t em_id) const {
+    return min_in_latency[em_id];
+}
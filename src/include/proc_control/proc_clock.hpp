@@ -0,0 +1,182 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+/** @brief How the virtual clock of an emulated process advances */
+enum class ClockMode {
+    WALL, ///< By real time elapsed during the awakening
+    CPU ///< By real time the process was not kept waiting for a CPU
+};
+
+/** @brief Source of the time an emulated process spent runnable, but
+ *         not running
+ *
+ * In @ref ClockMode::CPU mode it keeps `/proc/<pid>/task` open and sums
+ * `schedstat` of every thread - the time it ran on a CPU and the time it
+ * waited on a run queue. Subtracting the run delay from the wall time of
+ * an awakening charges the process only for time it either ran on a CPU
+ * or was blocked on its own (e.g. waiting for a packet), so neither host
+ * contention nor the emulator's own work shifts its virtual clock.
+ * Pure on-CPU time is not used, as it would never advance the clock
+ * of a process waiting for a packet.
+ *
+ * Threads wait on run queues at the same time as others run, so between
+ * two reads the process is only counted as kept waiting for as long as
+ * its threads waited, but not longer than none of them ran (wall time 
+ * minus their CPU time). A busy multi-threaded process is then charged
+ * its CPU time, and a single thread exactly its own run delay.
+ *
+ * In @ref ClockMode::WALL mode the delay is always 0.
+ */
+class ProcClock {
+
+    /** @brief Counters of a thread at the last read */
+    struct Task {
+        int tid; ///< Thread id
+        long long on_cpu; ///< Time run on a CPU (ns)
+        long long delay; ///< Time waited on a run queue (ns)
+    };
+
+    DIR* task_dir; ///< `/proc/<pid>/task` (nullptr in wall mode)
+    std::vector<Task> tasks; ///< Threads seen at the last read
+    std::vector<Task> scratch; ///< Threads being read
+    long long last_read; ///< Monotonic time of the last read (ns)
+    long long run_delay; ///< Time the process was kept waiting so far (ns)
+
+public:
+
+    /** @brief Opens the thread directory of @p pid if @p mode needs it
+     *
+     * Falls back to @ref ClockMode::WALL if schedstat can't be read
+     * (kernel without `CONFIG_SCHEDSTATS`).
+     *
+     * @param pid Process to account
+     * @param mode Accounting mode
+     */
+    ProcClock(int pid, ClockMode mode);
+    ~ProcClock();
+
+    ProcClock(ProcClock&& other) noexcept;
+    ProcClock(const ProcClock&) = delete;
+    ProcClock& operator=(const ProcClock&) = delete;
+
+    /** @brief Get total time the process spent waiting for a CPU
+     *
+     * If no thread can be read anymore (process exited), returns
+     * the last value.
+     *
+     * @return Run delay in ns (0 in wall mode)
+     */
+    long long get_run_delay();
+
+private:
+
+    /** @brief Reads schedstat of all threads into @ref scratch
+     *
+     * @return False if no thread could be read
+     */
+    bool read_tasks();
+
+};
+
+ProcClock::ProcClock(int pid, ClockMode mode): task_dir(nullptr), last_read(0),
+        run_delay(0) {
+    char path[64];
+
+    if (mode != ClockMode::CPU)
+        return;
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    task_dir = opendir(path);
+    if (task_dir == nullptr || !read_tasks()) {
+        perror("read schedstat, falling back to wall clock");
+        if (task_dir != nullptr)
+            closedir(task_dir);
+        task_dir = nullptr;
+        return;
+    }
+    tasks.swap(scratch);
+}
+
+ProcClock::~ProcClock() {
+    if (task_dir != nullptr)
+        closedir(task_dir);
+}
+
+ProcClock::ProcClock(ProcClock&& other) noexcept:
+        task_dir(other.task_dir), tasks(std::move(other.tasks)), 
+        last_read(other.last_read), run_delay(other.run_delay) {
+    other.task_dir = nullptr;
+}
+
+long long ProcClock::get_run_delay() {
+    long long on_cpu = 0, delay = 0, wall;
+    size_t last = 0;
+
+    if (task_dir == nullptr)
+        return run_delay;
+    wall = -last_read;
+    if (!read_tasks())
+        return run_delay;
+    wall += last_read;
+
+    /* Growth of counters of threads seen before, whole counters of new
+       ones (both lists sorted by tid) */
+    for (const Task& task: scratch) {
+        while (last < tasks.size() && tasks[last].tid < task.tid)
+            last++;
+        bool known = last < tasks.size() && tasks[last].tid == task.tid;
+        on_cpu += task.on_cpu - (known ? tasks[last].on_cpu : 0);
+        delay += task.delay - (known ? tasks[last].delay : 0);
+    }
+    tasks.swap(scratch);
+
+    run_delay += std::max(0LL, std::min(delay, wall - on_cpu));
+    return run_delay;
+}
+
+bool ProcClock::read_tasks() {
+    struct dirent* entry;
+    struct timespec now;
+    char path[64], buf[96];
+    char* end;
+    ssize_t size;
+    int fd;
+
+    scratch.clear();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    last_read = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+    rewinddir(task_dir);
+    while ((entry = readdir(task_dir)) != nullptr) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/schedstat", entry->d_name);
+        fd = openat(dirfd(task_dir), path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue; /* Thread exited */
+        size = pread(fd, buf, sizeof(buf) - 1, 0);
+        close(fd);
+        if (size <= 0)
+            continue;
+
+        /* Format: <on-cpu ns> <run delay ns> <timeslices> */
+        buf[size] = '\0';
+        Task task;
+        task.tid = atoi(entry->d_name);
+        task.on_cpu = strtoll(buf, &end, 10);
+        task.delay = strtoll(end, nullptr, 10);
+        scratch.push_back(task);
+    }
+    std::sort(scratch.begin(), scratch.end(), 
+        [](const Task& t1, const Task& t2) { return t1.tid < t2.tid; });
+    return !scratch.empty();
+}
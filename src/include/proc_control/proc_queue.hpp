@@ -0,0 +1,206 @@
+#pragma once
+
+#include <assert.h>
+#include <limits.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "proc_control/emproc.hpp"
+
+/** @brief Indexed min-heap of emulated processes keyed on virtual clock
+ *
+ * Holds every schedulable process exactly once, ordered by its virtual
+ * clock (in nanoseconds) with ties broken by the lower @ref em_id_t, which
+ * is the order in which the emulator has always picked processes.
+ * Every process' position in the heap is tracked, so the key of an
+ * arbitrary process can be increased or decreased in O(log n).
+ */
+class ProcQueue {
+
+    std::vector<em_id_t> heap; ///< Binary heap of process ids
+    std::vector<int> position; ///< Index of every process in @ref heap (-1 if absent)
+    std::vector<long long> clock; ///< Key (virtual clock in ns) of every process
+
+public:
+
+    /** @brief Creates an empty queue able to hold processes 0 .. @p procs - 1
+     *
+     * @param procs Number of processes in the emulation
+     */
+    ProcQueue(int procs);
+
+    /** @brief Inserts process @p em_id with virtual clock @p clock_ns
+     *
+     * @param em_id Process to insert (must not be in the queue)
+     * @param clock_ns Virtual clock of the process in nanoseconds
+     */
+    void push(em_id_t em_id, long long clock_ns);
+
+    /** @brief Changes the virtual clock of @p em_id (decrease or increase key)
+     *
+     * @param em_id Process to update (must be in the queue)
+     * @param clock_ns New virtual clock of the process in nanoseconds
+     */
+    void update(em_id_t em_id, long long clock_ns);
+
+    /** @brief Removes @p em_id from the queue
+     *
+     * @param em_id Process to remove (must be in the queue)
+     */
+    void erase(em_id_t em_id);
+
+    /** @brief Get the process with the lowest virtual clock
+     *
+     * @return Id of the process to be scheduled next
+     */
+    em_id_t top() const;
+
+    /** @brief Get the virtual clock @p em_id was last queued with
+     *
+     * @param em_id Process to query
+     * @return Virtual clock in nanoseconds
+     */
+    long long get_clock(em_id_t em_id) const;
+
+    /** @brief Get the lowest virtual clock among queued processes other than @p em_id
+     *
+     * Only the root and its two children need to be inspected.
+     *
+     * @param em_id Process to exclude
+     * @return Virtual clock in nanoseconds (LLONG_MAX if no other process)
+     */
+    long long min_clock_except(em_id_t em_id) const;
+
+    /** @brief Check if @p em_id is currently queued
+     *
+     * @param em_id Process to query
+     * @return If the process is in the queue
+     */
+    bool contains(em_id_t em_id) const;
+
+    bool empty() const;
+    int size() const;
+
+private:
+
+    bool before(em_id_t a, em_id_t b) const;
+    void place(int index, em_id_t em_id);
+    void sift_up(int index);
+    void sift_down(int index);
+
+};
+
+ProcQueue::ProcQueue(int procs): position(procs, -1), clock(procs, 0) {
+    heap.reserve(procs);
+}
+
+void ProcQueue::push(em_id_t em_id, long long clock_ns) {
+    assert(!contains(em_id));
+    clock[em_id] = clock_ns;
+    heap.push_back(em_id);
+    position[em_id] = heap.size() - 1;
+    sift_up(heap.size() - 1);
+}
+
+void ProcQueue::update(em_id_t em_id, long long clock_ns) {
+    assert(contains(em_id));
+    long long old_clock = clock[em_id];
+    clock[em_id] = clock_ns;
+
+    if (clock_ns < old_clock)
+        sift_up(position[em_id]);
+    else
+        sift_down(position[em_id]);
+}
+
+void ProcQueue::erase(em_id_t em_id) {
+    assert(contains(em_id));
+    int index = position[em_id];
+    em_id_t last = heap.back();
+
+    heap.pop_back();
+    position[em_id] = -1;
+    if (last == em_id)
+        return;
+
+    place(index, last);
+    sift_up(index);
+    sift_down(position[last]);
+}
+
+em_id_t ProcQueue::top() const {
+    return heap.front();
+}
+
+long long ProcQueue::get_clock(em_id_t em_id) const {
+    return clock[em_id];
+}
+
+long long ProcQueue::min_clock_except(em_id_t em_id) const {
+    if (heap.empty())
+        return LLONG_MAX;
+    if (heap[0] != em_id)
+        return clock[heap[0]];
+
+    long long result = LLONG_MAX;
+    for (size_t child = 1; child <= 2 && child < heap.size(); ++child)
+        result = std::min(result, clock[heap[child]]);
+    return result;
+}
+
+bool ProcQueue::contains(em_id_t em_id) const {
+    return position[em_id] >= 0;
+}
+
+bool ProcQueue::empty() const {
+    return heap.empty();
+}
+
+int ProcQueue::size() const {
+    return heap.size();
+}
+
+/* PRIVATE METHODS */
+
+bool ProcQueue::before(em_id_t a, em_id_t b) const {
+    if (clock[a] != clock[b])
+        return clock[a] < clock[b];
+    return a < b;
+}
+
+void ProcQueue::place(int index, em_id_t em_id) {
+    heap[index] = em_id;
+    position[em_id] = index;
+}
+
+void ProcQueue::sift_up(int index) {
+    em_id_t em_id = heap[index];
+
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!before(em_id, heap[parent]))
+            break;
+        place(index, heap[parent]);
+        index = parent;
+    }
+    place(index, em_id);
+}
+
+void ProcQueue::sift_down(int index) {
+    em_id_t em_id = heap[index];
+    int count = heap.size();
+
+    while (true) {
+        int child = 2 * index + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count && before(heap[child + 1], heap[child]))
+            child++;
+        if (!before(heap[child], em_id))
+            break;
+        place(index, heap[child]);
+        index = child;
+    }
+    place(index, em_id);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "utils.hpp"
+#include "logger.hpp"
+
+/** @brief Policy trading virtual time accuracy for fewer awakenings
+ *
+ * Every awakening costs a `SIGCONT`/`SIGSTOP` round trip, which
+ * dominates when the safe windows are short. The policy:
+ *  - extends windows shorter than the minimum quantum up to it, but
+ *    never more than the maximum overrun past the safe window (such a
+ *    quantum may let a packet arrive after its receiver's clock passed
+ *    the delivery time),
+ *  - in batch mode lets a process run up to that many consecutive
+ *    maximal windows in one awakening, as long as nothing can arrive at
+ *    it meanwhile (this never costs accuracy).
+ *
+ * It also accumulates the overrun it granted and the lateness of packets
+ * actually delivered late, i.e. the virtual time error it introduced.
+ */
+class QuantumPolicy {
+
+    long long min_quantum; ///< Shortest quantum (ns), 0 if windows are never extended
+    long long max_overrun; ///< Longest extension past the safe window (ns), -1 if unlimited
+    int batch; ///< Maximal windows a process may run in one awakening
+
+    unsigned long long awakenings; ///< Windows handed out
+    unsigned long long extended; ///< Windows extended past the safe window
+    long long overrun_total; ///< Sum of extensions past the safe window (ns)
+    long long overrun_max; ///< Longest extension past the safe window (ns)
+    unsigned long long late_packets; ///< Packets scheduled after receiver's clock
+    long long late_total; ///< Sum of lateness of late packets (ns)
+    long long late_max; ///< Highest lateness of a late packet (ns)
+
+public:
+
+    /** @brief Creates the policy, default arguments keep windows exact
+     *
+     * @param min_quantum Shortest quantum in nanoseconds
+     * @param max_overrun Longest extension past the safe window in nanoseconds (-1 if unlimited)
+     * @param batch Maximal windows a process may run in one awakening
+     */
+    QuantumPolicy(long long min_quantum = 0, long long max_overrun = -1, int batch = 1);
+
+    /** @brief Get how many maximal windows a process may run at once
+     *
+     * @return Batch size (at least 1)
+     */
+    int get_batch() const;
+
+    /** @brief Turns safe window into the quantum the process will run
+     *
+     * @param safe Safe window in nanoseconds
+     * @param at_least Shortest quantum the caller needs, applied after
+     *        the maximum overrun (counted as overrun as well)
+     * @return Quantum in nanoseconds, at least @p safe and @p at_least
+     */
+    long long quantum(long long safe, long long at_least = 0);
+
+    /** @brief Records packet scheduled for delivery at @p delivery_ts
+     *         to a process whose clock is already @p receiver_clock
+     *
+     * @param delivery_ts Delivery time of the packet in nanoseconds
+     * @param receiver_clock Virtual clock of the receiver in nanoseconds
+     */
+    void record_delivery(long long delivery_ts, long long receiver_clock);
+
+    /** @brief Print granted overrun and measured delivery error
+     */
+    void print_stats() const;
+
+};
+
+QuantumPolicy::QuantumPolicy(long long min_quantum, long long max_overrun, int batch):
+        min_quantum(min_quantum), max_overrun(max_overrun),
+        batch(std::max(batch, 1)), awakenings(0), extended(0),
+        overrun_total(0), overrun_max(0), late_packets(0), late_total(0),
+        late_max(0) {}
+
+int QuantumPolicy::get_batch() const {
+    return batch;
+}
+
+long long QuantumPolicy::quantum(long long safe, long long at_least) {
+    long long window = std::max(safe, min_quantum);
+
+    if (max_overrun >= 0)
+        window = std::min(window, safe + max_overrun);
+    window = std::max(window, at_least);
+
+    awakenings++;
+    if (window > safe) {
+        extended++;
+        overrun_total += window - safe;
+        overrun_max = std::max(overrun_max, window - safe);
+    }
+    return window;
+}
+
+void QuantumPolicy::record_delivery(long long delivery_ts, long long receiver_clock) {
+    if (delivery_ts >= receiver_clock)
+        return;
+    late_packets++;
+    late_total += receiver_clock - delivery_ts;
+    late_max = std::max(late_max, receiver_clock - delivery_ts);
+}
+
+void QuantumPolicy::print_stats() const {
+    char buf[BUF_SIZE];
+
+    snprintf(buf, sizeof(buf),
+        "Quanta: %llu awakenings, %llu extended (overrun total %lld us, max %lld us), "
+        "%llu packets late (total %lld us, max %lld us)\n",
+        awakenings, extended, overrun_total / MICROSECOND, overrun_max / MICROSECOND,
+        late_packets, late_total / MICROSECOND, late_max / MICROSECOND);
+    Logger::print_string_safe(buf);
+    LOG(INFO, SCHED, "%s", buf);
+}
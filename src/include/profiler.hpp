@@ -0,0 +1,332 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "utils.hpp"
+#include "logger.hpp"
+
+/** @brief Phases of the emulation loop timed by the @ref Profiler */
+enum class Phase {
+    SCHEDULE, ///< Choosing next process, its window and requeueing it
+    RESUME,   ///< Sending SIGCONT (or thawing), not waiting until process runs
+    PAUSE,    ///< SIGSTOP (or freeze) until process is stopped
+    WAIT,     ///< Blocked in poller while process runs
+    TUN_READ, ///< Reading packets sent by running process
+    TUN_WRITE,///< Writing packets delivered to running process
+    ROUTE,    ///< Scheduling sent packets to receivers
+    REWRITE,  ///< Rewriting addresses and checksums of packets
+    COUNT     ///< Number of phases
+};
+
+/** @brief Histogram of nanosecond values with bounded relative error
+ *
+ * HDR-style: values below @ref SUB are counted exactly, above that
+ * every power of two is split into SUB / 2 buckets, so the value
+ * reported for a bucket is within 1/16 of the recorded ones.
+ */
+class Histogram {
+
+    static const int SUB_BITS = 5;
+    static const long long SUB = 1LL << SUB_BITS; ///< Exact values, buckets per 2 octaves
+    static const int BUCKETS = 64 * SUB / 2; ///< Enough for any 63-bit value
+
+    unsigned long long counts[BUCKETS]; ///< Values recorded in each bucket
+    unsigned long long count; ///< Values recorded
+    long long total; ///< Sum of recorded values
+    long long max; ///< Largest recorded value
+
+public:
+
+    Histogram();
+
+    /** @brief Record @p value (negative ones are recorded as 0) */
+    void record(long long value);
+
+    /** @brief Get the value below which @p percentile % of recorded are
+     *         (upper bound of its bucket)
+     */
+    long long percentile(double percentile) const;
+
+    unsigned long long get_count() const;
+    long long get_max() const;
+    long long get_mean() const;
+
+private:
+
+    /** @brief Get bucket of @p value */
+    static int bucket(long long value);
+
+    /** @brief Get largest value of @p bucket */
+    static long long bucket_top(int bucket);
+
+};
+
+/** @brief Low-overhead profiler of the emulation loop
+ *
+ * Times @ref Phase s with @ref ProfileScope (CLOCK_MONOTONIC_RAW) and
+ * collects histograms of resume and pause signalling and of quantum
+ * overshoot. The kernel reports WCONTINUED as soon as SIGCONT is sent,
+ * so the resume histogram is the cost of delivering the signal, not
+ * the time until the process runs again.
+ * Nested scopes are subtracted from the enclosing one, so phase times
+ * add up to the run time. Nothing is measured unless enabled.
+ *
+ * The profiler is not thread-safe, it's used only by the emulator's thread.
+ */
+class Profiler {
+
+    friend class ProfileScope;
+
+    static const char* const PHASE_NAMES[(int)Phase::COUNT]; ///< Names of phases, in printed table
+
+    bool enabled; ///< Whether anything is measured
+    long long run_start; ///< Time emulation loop started (ns)
+    long long run_time; ///< Time spent in emulation loops (ns)
+    long long phase_time[(int)Phase::COUNT]; ///< Time in each phase, without nested (ns)
+    unsigned long long phase_calls[(int)Phase::COUNT]; ///< Scopes of each phase
+    class ProfileScope* current; ///< Innermost open scope (nullptr if none)
+
+public:
+
+    Histogram resume_signal; ///< Sending SIGCONT and its WCONTINUED (or thaw), before process runs
+    Histogram pause_latency; ///< SIGSTOP (or freeze) until stopped
+    Histogram overshoot; ///< Time a quantum ran past its length (elapsed_time - ts)
+
+    /** @brief Get the profiler of the emulator
+     *
+     * @return Global profiler
+     */
+    static Profiler& instance();
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    /** @brief Start measuring */
+    void enable();
+
+    bool is_enabled() const;
+
+    /** @brief Get CLOCK_MONOTONIC_RAW time (ns) */
+    static long long now();
+
+    /** @brief Record time a quantum ran past its length (if enabled) */
+    void record_overshoot(long long value);
+
+    /** @brief Mark start of emulation loop */
+    void start_run();
+
+    /** @brief Mark end of emulation loop */
+    void stop_run();
+
+    /** @brief Print time of every phase and percentiles of histograms
+     */
+    void print_stats() const;
+
+private:
+
+    Profiler();
+
+    /** @brief Prints line of @p histogram named @p name to @p buf */
+    static int print_histogram(char* buf, size_t size, const char* name, const Histogram& histogram);
+
+};
+
+/** @brief Times a @ref Phase from construction to end of the scope */
+class ProfileScope {
+
+    friend class Profiler;
+
+    Phase phase; ///< Phase being timed
+    Histogram* latency; ///< Histogram of durations of the scope (nullptr if none)
+    long long start; ///< Time scope was opened (ns, -1 if profiler disabled)
+    long long nested; ///< Time spent in nested scopes (ns)
+    ProfileScope* parent; ///< Enclosing scope (nullptr if none)
+
+public:
+
+    /** @brief Opens scope of @p phase (no-op if profiler is disabled)
+     *
+     * @param phase Phase being timed
+     * @param latency Histogram to record duration of the scope to
+     */
+    ProfileScope(Phase phase, Histogram* latency = nullptr);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+};
+
+
+Histogram::Histogram(): counts(), count(0), total(0), max(0) {}
+
+void Histogram::record(long long value) {
+    if (value < 0)
+        value = 0;
+    counts[bucket(value)]++;
+    count++;
+    total += value;
+    if (value > max)
+        max = value;
+}
+
+long long Histogram::percentile(double percentile) const {
+    unsigned long long seen = 0, needed;
+
+    if (count == 0)
+        return 0;
+    needed = (unsigned long long)(percentile / 100.0 * count);
+    if (needed == 0)
+        needed = 1;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= needed)
+            return std::min(bucket_top(i), max);
+    }
+    return max;
+}
+
+unsigned long long Histogram::get_count() const {
+    return count;
+}
+
+long long Histogram::get_max() const {
+    return max;
+}
+
+long long Histogram::get_mean() const {
+    return count ? total / (long long)count : 0;
+}
+
+int Histogram::bucket(long long value) {
+    if (value < SUB)
+        return value;
+    int shift = 63 - __builtin_clzll(value) - (SUB_BITS - 1);
+    return shift * (SUB / 2) + (value >> shift);
+}
+
+long long Histogram::bucket_top(int bucket) {
+    if (bucket < SUB)
+        return bucket;
+    int shift = bucket / (SUB / 2) - 1;
+    long long mantissa = bucket - shift * (SUB / 2);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+const char* const Profiler::PHASE_NAMES[(int)Phase::COUNT] = {
+    "schedule", "resume", "pause", "wait", "tun read", "tun write", "route", "rewrite"
+};
+
+Profiler& Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler(): enabled(false), run_start(0), run_time(0), phase_time(),
+        phase_calls(), current(nullptr) {}
+
+void Profiler::enable() {
+    enabled = true;
+}
+
+bool Profiler::is_enabled() const {
+    return enabled;
+}
+
+long long Profiler::now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return nano_from_ts(now);
+}
+
+void Profiler::record_overshoot(long long value) {
+    if (enabled)
+        overshoot.record(value);
+}
+
+void Profiler::start_run() {
+    if (enabled)
+        run_start = now();
+}
+
+void Profiler::stop_run() {
+    if (enabled)
+        run_time += now() - run_start;
+}
+
+void Profiler::print_stats() const {
+    char buf[BUF_SIZE];
+    long long measured = 0;
+
+    if (!enabled)
+        return;
+
+    Logger::print_string_safe("Profile of emulation loop:\n");
+    snprintf(buf, sizeof(buf), "  %-10s %12s %12s %7s %10s\n", "phase", "calls", "total ms", "%", "mean us");
+    Logger::print_string_safe(buf);
+    for (int i = 0; i < (int)Phase::COUNT; ++i) {
+        measured += phase_time[i];
+        snprintf(buf, sizeof(buf), "  %-10s %12llu %12.3f %6.1f%% %10.3f\n", PHASE_NAMES[i],
+            phase_calls[i], (double)phase_time[i] / MILLISECOND,
+            run_time ? 100.0 * phase_time[i] / run_time : 0.0,
+            phase_calls[i] ? (double)phase_time[i] / phase_calls[i] / MICROSECOND : 0.0);
+        Logger::print_string_safe(buf);
+    }
+    snprintf(buf, sizeof(buf), "  %-10s %12s %12.3f %6.1f%%\n  %-10s %12s %12.3f\n",
+        "other", "", (double)(run_time - measured) / MILLISECOND,
+        run_time ? 100.0 * (run_time - measured) / run_time : 0.0,
+        "run", "", (double)run_time / MILLISECOND);
+    Logger::print_string_safe(buf);
+
+    snprintf(buf, sizeof(buf), "  %-10s %10s %10s %10s %10s %10s %10s (us)\n",
+        "latency", "count", "p50", "p90", "p99", "p99.9", "max");
+    Logger::print_string_safe(buf);
+    print_histogram(buf, sizeof(buf), "resume sig", resume_signal);
+    Logger::print_string_safe(buf);
+    print_histogram(buf, sizeof(buf), "pause", pause_latency);
+    Logger::print_string_safe(buf);
+    print_histogram(buf, sizeof(buf), "overshoot", overshoot);
+    Logger::print_string_safe(buf);
+}
+
+int Profiler::print_histogram(char* buf, size_t size, const char* name, const Histogram& histogram) {
+    return snprintf(buf, size, "  %-10s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+        histogram.get_count(),
+        (double)histogram.percentile(50) / MICROSECOND,
+        (double)histogram.percentile(90) / MICROSECOND,
+        (double)histogram.percentile(99) / MICROSECOND,
+        (double)histogram.percentile(99.9) / MICROSECOND,
+        (double)histogram.get_max() / MICROSECOND);
+}
+
+ProfileScope::ProfileScope(Phase phase, Histogram* latency): phase(phase), latency(latency), 
+        start(-1), nested(0), parent(nullptr) {
+    Profiler& profiler = Profiler::instance();
+
+    if (!profiler.enabled)
+        return;
+    parent = profiler.current;
+    profiler.current = this;
+    start = Profiler::now();
+}
+
+ProfileScope::~ProfileScope() {
+    if (start < 0)
+        return;
+
+    Profiler& profiler = Profiler::instance();
+    long long elapsed = Profiler::now() - start;
+
+    profiler.phase_time[(int)phase] += elapsed - nested;
+    profiler.phase_calls[(int)phase]++;
+    if (latency)
+        latency->record(elapsed);
+    if (parent)
+        parent->nested += elapsed;
+    profiler.current = parent;
+}
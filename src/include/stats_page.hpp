@@ -0,0 +1,188 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <atomic>
+#include <new>
+#include <string>
+
+#include "utils.hpp"
+
+#define STATS_MAGIC "TINYEMST" ///< First 8 bytes of a stats segment
+#define STATS_VERSION 1 ///< Version of stats segment layout
+
+/** @brief Counters of a single emulated process
+ *
+ * Packet counters are kept by @ref EMProc and the emulator, the rest is
+ * filled in when published.
+ */
+struct ProcStats {
+    int64_t virtual_clock; ///< Virtual clock (ns)
+    uint64_t quanta; ///< Awakenings run
+    uint64_t packets_out; ///< Packets sent to processes in the emulation
+    uint64_t bytes_out; ///< Bytes of packets_out
+    uint64_t packets_in; ///< Packets delivered to the process
+    uint64_t bytes_in; ///< Bytes of packets_in
+    uint64_t foreign; ///< Packets sent outside emulation, or not IPv4
+    uint64_t dropped; ///< Packets sent, but dropped (link queue full, receiver exited)
+    uint32_t in_queue; ///< Packets waiting to be delivered to the process
+    uint32_t out_queue; ///< Packets sent, but not yet scheduled
+    uint32_t exited; ///< Whether the process has exited
+    uint32_t reserved; ///< Padding, 0
+};
+
+/** @brief Start of a stats segment, followed by @ref procs ProcStats
+ *
+ * Written by the emulator only. @ref seq is odd while a snapshot is
+ * being written, readers copy the segment and retry if @ref seq was
+ * odd or changed meanwhile (seqlock).
+ */
+struct StatsHeader {
+    char magic[8]; ///< STATS_MAGIC, without NUL
+    uint32_t version; ///< STATS_VERSION
+    uint32_t procs; ///< Number of emulated processes
+    std::atomic<uint64_t> seq; ///< Sequence number of the seqlock
+    int32_t pid; ///< pid of the emulator
+    uint32_t finished; ///< Whether emulation has ended (last snapshot)
+    int64_t wall_ns; ///< Real time since emulation started (ns)
+    uint64_t steps; ///< Awakenings performed
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "seqlock needs lock-free atomics");
+
+/** @brief Size of stats segment of @p procs processes */
+size_t stats_segment_size(uint32_t procs) {
+    return sizeof(StatsHeader) + procs * sizeof(ProcStats);
+}
+
+/** @brief Copies consistent snapshot of a stats segment (seqlock reader)
+ *
+ * @param segment Mapped stats segment
+ * @param header Where to copy the header (without seq)
+ * @param procs Where to copy header->procs process stats
+ */
+void stats_snapshot(const StatsHeader* segment, StatsHeader* header, ProcStats* procs) {
+    const ProcStats* source = (const ProcStats*)(segment + 1);
+    uint64_t before, after;
+
+    do {
+        before = segment->seq.load(std::memory_order_acquire);
+        if (before & 1)
+            continue; /* Being written */
+        memcpy(header->magic, segment->magic, sizeof(header->magic));
+        header->version = segment->version;
+        header->procs = segment->procs;
+        header->pid = segment->pid;
+        header->finished = segment->finished;
+        header->wall_ns = segment->wall_ns;
+        header->steps = segment->steps;
+        memcpy(procs, source, segment->procs * sizeof(ProcStats));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = segment->seq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+/** @brief Shared-memory segment with live counters of the emulation
+ *
+ * The emulator publishes a snapshot of all counters at most every
+ * @ref PERIOD_NS of real time (and once when it ends) to POSIX shared
+ * memory object @ref name, read by tinyem-stat. Publishing is a
+ * seqlock write, so it never waits for readers.
+ */
+class StatsPage {
+
+    static const long long PERIOD_NS = 100LL * MILLISECOND; ///< Real time between snapshots
+
+    std::string name; ///< Name of the shared memory object
+    StatsHeader* header; ///< Mapped segment
+    ProcStats* procs; ///< Process stats in the segment
+    struct timespec start_time; ///< CLOCK_MONOTONIC time of creation
+    long long next_ns; ///< Real time (since start) of next snapshot
+
+public:
+
+    /** @brief Creates shared memory object @p name for @p count
+     *         processes, exits on failure
+     *
+     * @param name Name of the object (starting with '/')
+     * @param count Number of emulated processes
+     */
+    StatsPage(const std::string& name, int count);
+
+    /** @brief Unmaps and removes the shared memory object */
+    ~StatsPage();
+
+    /** @brief Check whether next snapshot should be published */
+    bool due() const;
+
+    /** @brief Starts a snapshot, to be filled with @ref proc */
+    void begin();
+
+    /** @brief Get stats of process @p em_id in the snapshot being written */
+    ProcStats& proc(int em_id);
+
+    /** @brief Ends snapshot started by @ref begin
+     *
+     * @param steps Awakenings performed
+     * @param finished Whether emulation has ended
+     */
+    void end(unsigned long long steps, bool finished = false);
+
+};
+
+StatsPage::StatsPage(const std::string& name, int count): name(name), next_ns(0) {
+    size_t size = stats_segment_size(count);
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        perror(name.c_str());
+        exit(1);
+    }
+    void* segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        perror(name.c_str());
+        exit(1);
+    }
+
+    header = new (segment) StatsHeader(); /* Zeroed by ftruncate */
+    procs = (ProcStats*)(header + 1);
+    memcpy(header->magic, STATS_MAGIC, sizeof(header->magic));
+    header->version = STATS_VERSION;
+    header->procs = count;
+    header->pid = getpid();
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+StatsPage::~StatsPage() {
+    munmap(header, stats_segment_size(header->procs));
+    shm_unlink(name.c_str());
+}
+
+bool StatsPage::due() const {
+    return nano_from_ts(get_time_since(start_time)) >= next_ns;
+}
+
+void StatsPage::begin() {
+    header->seq.store(header->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+ProcStats& StatsPage::proc(int em_id) {
+    return procs[em_id];
+}
+
+void StatsPage::end(unsigned long long steps, bool finished) {
+    header->wall_ns = nano_from_ts(get_time_since(start_time));
+    header->steps = steps;
+    header->finished = finished;
+    header->seq.store(header->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    next_ns = header->wall_ns + PERIOD_NS;
+}
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <netinet/ip_icmp.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+#include "logger.hpp"
+#include "config-parser.hpp"
+#include "network/packet.hpp"
+#include "network/packet_queue.hpp"
+#include "network/network.hpp"
+#include "network/loopback_network.hpp"
+
+/*
+ * Microbenchmarks of the packet hot path. Every benchmark is calibrated
+ * to run at least MIN_RUN_NS, then repeated and the median reported as
+ * one JSON object per line:
+ *   {"bench": ..., "param": ..., "iterations": ..., "ns_per_op": ..., "allocs_per_op": ...}
+ * Allocations are calls of operator new during the measured runs.
+ *
+ * Before benchmarking, checksums updated by rewrite_addrs are checked
+ * against full recomputation; the program fails if they differ.
+ *
+ * get_em_id and the loopback network need a configuration, and run
+ * only with --config FILE. The configuration is served by a
+ * LoopbackNetwork, so no root is needed and no TUN is created.
+ */
+
+Logger* logger_ptr = nullptr;
+
+static unsigned long long allocations = 0; ///< Calls of operator new so far
+
+void* operator new(size_t size) {
+    allocations++;
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+/* GCC pairs the inlined free with operator new above, which is fine here */
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+static const long long MIN_RUN_NS = 20LL * MILLISECOND; ///< Shortest measured run
+static const int PAYLOADS[] = {0, 64, 512, 1400}; ///< Payload sizes of packets (bytes)
+
+static int repetitions = 5; ///< Measured runs of every benchmark
+
+/** @brief Keeps @p value from being optimized away */
+template <typename T>
+static void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+/** @brief Runs @p op @p iterations times, returns time it took (ns) */
+static long long run(const std::function<void(long long)>& op, long long iterations) {
+    struct timespec start_time;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    op(iterations);
+    return nano_from_ts(get_time_since(start_time));
+}
+
+/** @brief Measures @p op (running given number of operations) and prints result
+ *
+ * @param name Name of the benchmark
+ * @param param Parameter of the benchmark (payload size, queue depth)
+ * @param op Runs the operation given number of times
+ */
+static void bench(const char* name, int param, const std::function<void(long long)>& op) {
+    long long iterations = 1;
+    std::vector<double> ns_per_op;
+    unsigned long long allocs_before;
+
+    /* Warm up and calibrate */
+    while (run(op, iterations) < MIN_RUN_NS)
+        iterations *= 2;
+
+    allocs_before = allocations;
+    for (int i = 0; i < repetitions; ++i)
+        ns_per_op.push_back((double)run(op, iterations) / iterations);
+    double allocs_per_op = (double)(allocations - allocs_before) / repetitions / iterations;
+
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    printf("{\"bench\": \"%s\", \"param\": %d, \"iterations\": %lld, "
+           "\"ns_per_op\": %.2f, \"allocs_per_op\": %.3f}\n",
+        name, param, iterations, ns_per_op[ns_per_op.size() / 2], allocs_per_op);
+    fflush(stdout);
+}
+
+/** @brief Builds IPv4 frame with TCP, UDP or ICMP header and @p payload bytes
+ *
+ * @param buf Buffer of at least PacketPool::SLOT_SIZE bytes
+ * @param protocol IPPROTO_TCP, IPPROTO_UDP or IPPROTO_ICMP
+ * @param payload Bytes of payload
+ * @return Size of the frame
+ */
+static size_t build_frame(char* buf, int protocol, size_t payload) {
+    struct iphdr* ip = (struct iphdr*)buf;
+    size_t header = protocol == IPPROTO_TCP ? sizeof(struct tcphdr) : 
+                    protocol == IPPROTO_UDP ? sizeof(struct udphdr) : sizeof(struct icmphdr);
+    size_t size = sizeof(struct iphdr) + header + payload;
+
+    memset(buf, 0, size);
+    ip->version = 4;
+    ip->ihl = 5;
+    ip->ttl = 64;
+    ip->protocol = protocol;
+    ip->tot_len = htons(size);
+    ip->saddr = inet_addr("10.0.0.1");
+    ip->daddr = inet_addr("10.0.0.2");
+    if (protocol == IPPROTO_TCP) {
+        struct tcphdr* tcp = (struct tcphdr*)(ip + 1);
+        tcp->th_sport = htons(4000);
+        tcp->th_dport = htons(5000);
+        tcp->th_off = 5;
+        tcp->th_sum = htons(0x1234);
+    }
+    else if (protocol == IPPROTO_UDP) {
+        struct udphdr* udp = (struct udphdr*)(ip + 1);
+        udp->uh_sport = htons(4000);
+        udp->uh_dport = htons(5000);
+        udp->uh_ulen = htons(header + payload);
+        udp->uh_sum = htons(0x1234);
+    }
+    else {
+        struct icmphdr* icmp = (struct icmphdr*)(ip + 1);
+        icmp->type = ICMP_ECHO;
+        icmp->un.echo.id = htons(0x4242);
+        icmp->un.echo.sequence = htons(7);
+    }
+    for (size_t i = 0; i < payload; ++i)
+        buf[size - payload + i] = (char)i;
+    return size;
+}
+
+/** @brief Internet checksum (RFC 1071) of @p len bytes, as stored in headers
+ *
+ * @param data Checksummed bytes
+ * @param len Number of bytes
+ * @param sum Sum of preceding data (e.g. pseudo header)
+ */
+static uint16_t internet_checksum(const void* data, size_t len, uint32_t sum = 0) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint16_t word;
+
+    for (; len > 1; len -= 2, bytes += 2) {
+        memcpy(&word, bytes, sizeof(word));
+        sum += word;
+    }
+    if (len == 1) {
+        word = 0;
+        memcpy(&word, bytes, 1);
+        sum += word;
+    }
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return ~(uint16_t)sum;
+}
+
+/** @brief Full checksum of TCP segment or UDP datagram in @p buf,
+ *         with the pseudo header (checksum field included as stored)
+ */
+static uint16_t transport_checksum(const char* buf) {
+    const struct iphdr* ip = (const struct iphdr*)buf;
+    size_t header = ip->ihl * 4, len = ntohs(ip->tot_len) - header;
+    struct {
+        uint32_t saddr, daddr;
+        uint8_t zero, protocol;
+        uint16_t len;
+    } __attribute__((packed)) pseudo = {ip->saddr, ip->daddr, 0, ip->protocol, htons(len)};
+
+    uint32_t sum = (uint16_t)~internet_checksum(&pseudo, sizeof(pseudo));
+    return internet_checksum(buf + header, len, sum);
+}
+
+/** @brief Checks @ref Packet::rewrite_addrs against full recomputation
+ *
+ * Frames with valid checksums (TCP, UDP with and without checksum,
+ * ICMP echo; even and odd payloads) get random addresses many times.
+ * Afterwards IPv4 and TCP/UDP checksums have to verify, a disabled UDP
+ * checksum has to stay 0 and anything past the IPv4 header of other
+ * protocols has to stay intact.
+ *
+ * @return Whether all checks passed (failures are printed to stderr)
+ */
+static bool check_rewrite(char* frame) {
+    const struct { const char* name; int protocol; bool checksum; } cases[] = {
+        {"tcp", IPPROTO_TCP, true}, {"udp", IPPROTO_UDP, true},
+        {"udp_no_checksum", IPPROTO_UDP, false}, {"icmp", IPPROTO_ICMP, true},
+    };
+    unsigned seed = 1;
+    bool ok = true;
+
+    for (const auto& test: cases) {
+        for (int payload: {64, 63}) {
+            size_t size = build_frame(frame, test.protocol, payload);
+            struct iphdr* ip = (struct iphdr*)frame;
+            uint16_t* check = test.protocol == IPPROTO_TCP ? &((struct tcphdr*)(ip + 1))->th_sum :
+                              test.protocol == IPPROTO_UDP ? &((struct udphdr*)(ip + 1))->uh_sum :
+                                                             &((struct icmphdr*)(ip + 1))->checksum;
+            *check = 0;
+            if (test.protocol == IPPROTO_ICMP)
+                *check = internet_checksum(ip + 1, size - sizeof(*ip));
+            else if (test.checksum)
+                *check = transport_checksum(frame) ? transport_checksum(frame) : 0xffff;
+            ip->check = internet_checksum(ip, sizeof(*ip));
+
+            Packet packet(frame, size, {0, 0});
+            for (int i = 0; i < 1000; ++i) {
+                packet.rewrite_addrs(rand_r(&seed) ^ (rand_r(&seed) << 16), 
+                                     rand_r(&seed) ^ (rand_r(&seed) << 16));
+                const char* buf = packet.get_buffer();
+                const char* error = nullptr;
+
+                if (internet_checksum(buf, sizeof(*ip)) != 0)
+                    error = "wrong IPv4 checksum";
+                else if (test.protocol == IPPROTO_ICMP && 
+                         memcmp(buf + sizeof(*ip), frame + sizeof(*ip), size - sizeof(*ip)) != 0)
+                    error = "ICMP message changed";
+                else if (test.protocol != IPPROTO_ICMP && test.checksum && transport_checksum(buf) != 0)
+                    error = "wrong transport checksum";
+                else if (!test.checksum && memcmp(buf + ((const char*)check - frame), check, 2) != 0)
+                    error = "disabled UDP checksum changed";
+
+                if (error) {
+                    fprintf(stderr, "rewrite_addrs (%s, payload %d): %s\n", test.name, payload, error);
+                    ok = false;
+                    break;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+static void bench_construction(char* frame) {
+    for (int payload: PAYLOADS) {
+        size_t size = build_frame(frame, IPPROTO_TCP, payload);
+        bench("construct", payload, [&](long long n) {
+            for (long long i = 0; i < n; ++i) {
+                Packet packet(frame, size, {0, i});
+                keep(packet);
+            }
+        });
+    }
+
+    size_t size = build_frame(frame, IPPROTO_TCP, 64);
+    bench("move", 0, [&](long long n) {
+        Packet first(frame, size, {0, 0});
+        for (long long i = 0; i < n; ++i) {
+            Packet second(std::move(first));
+            first = std::move(second);
+            keep(first);
+        }
+    });
+}
+
+static void bench_lookup(char* frame, const std::string& config_path) {
+    size_t size = build_frame(frame, IPPROTO_TCP, 64);
+    Packet packet(frame, size, {0, 0});
+
+    bench("get_dest_addr", 0, [&](long long n) {
+        for (long long i = 0; i < n; ++i)
+            keep(packet.get_dest_addr());
+    });
+    bench("get_dest_in_addr", 0, [&](long long n) {
+        for (long long i = 0; i < n; ++i)
+            keep(packet.get_dest_in_addr());
+    });
+
+    if (config_path.empty())
+        return;
+
+    ConfigParser cp(config_path);
+    LoopbackNetwork network(cp, 0);
+    in_addr_t addr = network.get_in_addr(cp.procs - 1);
+    std::string addr_string = network.get_addr(cp.procs - 1);
+
+    bench("get_em_id", cp.procs, [&](long long n) {
+        for (long long i = 0; i < n; ++i)
+            keep(network.get_em_id(addr));
+    });
+    bench("get_em_id_string", cp.procs, [&](long long n) {
+        for (long long i = 0; i < n; ++i)
+            keep(network.get_em_id(addr_string));
+    });
+    bench("loopback_receive_send", cp.procs, [&](long long n) {
+        for (long long i = 0; i < n; ++i) {
+            Packet packet({0, i});
+            network.receive(packet);
+            network.send(std::move(packet));
+        }
+    });
+}
+
+static void bench_rewrite(char* frame) {
+    size_t size = build_frame(frame, IPPROTO_TCP, 512);
+    Packet packet(frame, size, {0, 0});
+    const std::string addrs[] = {"10.0.0.3", "10.0.0.4"};
+    const in_addr_t in_addrs[] = {inet_addr("10.0.0.3"), inet_addr("10.0.0.4")};
+
+    /* Alternating, so every rewrite changes the address */
+    bench("set_dest_addr_tcp", 512, [&](long long n) {
+        for (long long i = 0; i < n; ++i)
+            packet.set_dest_addr_tcp(addrs[i & 1]);
+        keep(packet);
+    });
+    bench("rewrite_addrs", 512, [&](long long n) {
+        for (long long i = 0; i < n; ++i)
+            packet.rewrite_addrs(in_addrs[i & 1], in_addrs[(i + 1) & 1]);
+        keep(packet);
+    });
+}
+
+static void bench_checksum(char* frame) {
+    for (int payload: PAYLOADS) {
+        size_t size = build_frame(frame, IPPROTO_TCP, payload);
+        Packet tcp_packet(frame, size, {0, 0});
+        bench("tcp_checksum", payload, [&](long long n) {
+            for (long long i = 0; i < n; ++i)
+                keep(tcp_packet.get_tcp_checksum());
+        });
+
+        size = build_frame(frame, IPPROTO_UDP, payload);
+        Packet udp_packet(frame, size, {0, 0});
+        bench("udp_checksum", payload, [&](long long n) {
+            for (long long i = 0; i < n; ++i)
+                keep(udp_packet.get_udp_checksum());
+        });
+    }
+}
+
+static void bench_queue(char* frame) {
+    size_t size = build_frame(frame, IPPROTO_TCP, 64);
+
+    for (int depth: {16, 1024, 65536}) {
+        PacketQueue queue;
+        unsigned seed = 1;
+
+        for (int i = 0; i < depth; ++i)
+            queue.push(Packet(frame, size, {0, rand_r(&seed) % SECOND}));
+
+        /* Pop the earliest, push it back later - as delivery does */
+        bench("queue_push_pop", depth, [&](long long n) {
+            for (long long i = 0; i < n; ++i) {
+                Packet packet = queue.pop();
+                packet.increase_ts({0, (long)(rand_r(&seed) % MILLISECOND)});
+                queue.push(std::move(packet));
+            }
+        });
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string config_path;
+    char frame[PacketPool::SLOT_SIZE];
+    bool check_only = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:r:kh")) != -1) {
+        switch (opt) {
+        case 'k':
+            check_only = true;
+            break;
+        case 'c':
+            config_path = optarg;
+            break;
+        case 'r':
+            repetitions = std::max(1, atoi(optarg));
+            break;
+        default:
+            std::cerr << "Usage: " << argv[0] << " [-k] [-r REPETITIONS] [-c CONFIG]\n"
+                      << "  -k       only check checksums of rewrite_addrs against full recomputation\n"
+                      << "  -r N     measured runs of every benchmark, median is reported (default 5)\n"
+                      << "  -c FILE  also benchmark get_em_id and loopback network of FILE (no root needed)\n";
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    logger_ptr = new Logger("/dev/null");
+    logger_ptr->set_level(LOG_LEVEL_OFF);
+
+    if (!check_rewrite(frame))
+        return 1;
+    if (check_only) {
+        delete logger_ptr;
+        return 0;
+    }
+
+    bench_construction(frame);
+    bench_lookup(frame, config_path);
+    bench_rewrite(frame);
+    bench_checksum(frame);
+    bench_queue(frame);
+
+    delete logger_ptr;
+    return 0;
+}
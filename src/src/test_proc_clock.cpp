@@ -0,0 +1,103 @@
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <thread>
+#include <vector>
+
+#include "proc_control/proc_clock.hpp"
+#include "utils.hpp"
+
+/*
+ * Checks that CPU clock mode charges a busy multi-threaded process
+ * roughly the CPU time it got. Everything is pinned to one CPU, where
+ * a child with THREADS spinning threads (and its main thread blocked
+ * in join) competes with one spinning process, so it gets about
+ * THREADS / (THREADS + 1) of the CPU.
+ */
+
+#define THREADS 4
+#define RUN_TIME (1 * SECOND)
+#define TOLERANCE 0.1 ///< Allowed difference as a fraction of RUN_TIME
+
+static void spin() {
+    volatile unsigned long long counter = 0;
+    while (true)
+        counter++;
+}
+
+static pid_t spawn_spinner(int threads) {
+    pid_t pid = fork();
+    if (pid < 0)
+        panic("fork");
+    if (pid > 0)
+        return pid;
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i)
+        workers.emplace_back(spin);
+    for (auto& worker: workers)
+        worker.join();
+    exit(0);
+}
+
+/* utime + stime of all threads of pid in ns */
+static long long get_cpu_time(pid_t pid) {
+    char path[64], buf[1024];
+    unsigned long long utime, stime;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* file = fopen(path, "r");
+    if (file == nullptr || fgets(buf, sizeof(buf), file) == nullptr)
+        panic("read stat");
+    fclose(file);
+    /* Fields after the command, which ends with the last ')' */
+    if (sscanf(strrchr(buf, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+            &utime, &stime) != 2)
+        panic("parse stat");
+    return (long long)(utime + stime) * SECOND / sysconf(_SC_CLK_TCK);
+}
+
+int main() {
+    cpu_set_t cpus;
+    struct timespec start_time, period = {0, 10 * MILLISECOND};
+
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+        panic("sched_setaffinity");
+
+    pid_t busy = spawn_spinner(THREADS);
+    pid_t rival = spawn_spinner(1);
+    usleep(100 * MICROSECOND); /* Let threads start */
+
+    ProcClock clock(busy, ClockMode::CPU);
+    long long start_delay = clock.get_run_delay();
+    long long start_cpu = get_cpu_time(busy);
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    /* Read as often as the emulator would while the process runs */
+    while (nano_from_ts(get_time_since(start_time)) < RUN_TIME) {
+        nanosleep(&period, nullptr);
+        clock.get_run_delay();
+    }
+    long long wall = nano_from_ts(get_time_since(start_time));
+    long long charged = wall - (clock.get_run_delay() - start_delay);
+    long long cpu = get_cpu_time(busy) - start_cpu;
+
+    kill(busy, SIGKILL);
+    kill(rival, SIGKILL);
+    waitpid(busy, nullptr, 0);
+    waitpid(rival, nullptr, 0);
+
+    bool ok = llabs(charged - cpu) < TOLERANCE * RUN_TIME;
+    printf("%d busy threads: wall %lld ms, CPU time %lld ms, charged %lld ms: %s\n",
+        THREADS, wall / MILLISECOND, cpu / MILLISECOND, charged / MILLISECOND, 
+        ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -5,12 +5,18 @@
 #include <time.h>
 #include <unistd.h>
 #include <string>
+#include <memory>
 
 #include "config-parser.hpp"
+#include "options.hpp"
 #include "utils.hpp"
 #include "logger.hpp"
 #include "network/network.hpp"
+#include "network/tun_network.hpp"
+#include "network/namespace_network.hpp"
+#include "network/loopback_network.hpp"
 #include "emulator.hpp"
+#include "profiler.hpp"
 
 Logger* logger_ptr = nullptr;
 Emulator* em_ptr = nullptr;
@@ -18,30 +24,56 @@ Emulator* em_ptr = nullptr;
 void signal_handler(int signum);
 
 int main(int argc, const char** argv) {
-	logger_ptr = new Logger("logging_tinyem.txt");
-
-	if (argc == 2) {
-		CONFIG_PATH = std::string(argv[1]);
-		// std::cout << CONFIG_PATH << std::endl;
-	}
-	if (argc > 2) {
-		Logger::print_string_safe("Usage: ./tinyem (config_file_name_with_extension)\n");
-	}
+	Options options(argc, argv);
+	logger_ptr = new Logger("logging_tinyem.txt", options.event_log_path);
+	logger_ptr->set_level(options.log_level);
+	CONFIG_PATH = options.config_path;
+	PacketPool::instance().set_hugepages(options.hugepages);
+	if (options.profile)
+		Profiler::instance().enable();
 
 	/* Configuration */
 	ConfigParser cp((const std::string) CONFIG_PATH);
-	Network network(cp);
-	em_ptr = new Emulator(network, cp);
-	
-	real_sleep(100 * MILLISECOND); /* Give some time */
+	std::unique_ptr<Network> network;
+	if (options.generate >= 0)
+		network.reset(new LoopbackNetwork(cp, options.no_processes ? 0 : options.generate, 
+		                                  options.payload));
+	else if (options.epochs)
+		network.reset(new NamespaceNetwork(cp));
+	else
+		network.reset(new TunNetwork(cp, options.io_uring));
+	if (options.no_processes)
+		em_ptr = new Emulator(*network, cp, SECOND / options.generate, 
+		                      options.quantum_policy());
+	else
+		em_ptr = new Emulator(*network, cp, options.clock_mode, 
+		                      options.quantum_policy(), options.freezer,
+		                      Launcher(options.env));
+	if (!options.record_path.empty())
+		em_ptr->record_schedule(options.record_path);
+	if (!options.replay_path.empty())
+		em_ptr->replay_schedule(options.replay_path);
+	if (!options.capture_path.empty())
+		em_ptr->capture_packets(options.capture_path);
+	if (!options.stats_name.empty())
+		em_ptr->publish_stats(options.stats_name);
 
 	/* Start emulation */
 	signal(SIGINT, signal_handler);
 	signal(SIGSEGV, signal_handler);
-	em_ptr->start_emulation(STEPS);
+	StopCondition stop = {options.steps, options.horizon, options.wall_budget};
+	if (options.epochs)
+		em_ptr->start_epoch_emulation(stop);
+	else
+		em_ptr->start_emulation(stop);
 
 	/* End emulation */
 	Logger::print_string_safe("EMULATION FINISHED\n");
+	network->print_stats();
+	PacketPool::instance().print_stats();
+	em_ptr->print_stats();
+	logger_ptr->print_stats();
+	Profiler::instance().print_stats();
 	em_ptr->kill_emulation();
 	delete logger_ptr;
 
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <time.h>
+#include <iostream>
+#include <string>
+
+#include "config-parser.hpp"
+#include "utils.hpp"
+
+/*
+ * Converts a text config of tinyem to the binary format, which tinyem
+ * maps and uses in place. Reports load time of both.
+ */
+int main(int argc, char* argv[]) {
+    struct timespec start_time;
+    double text_ms, binary_ms;
+
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <text config> <binary config>" << std::endl;
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    ConfigParser text_cp(argv[1]);
+    text_ms = (double)nano_from_ts(get_time_since(start_time)) / MILLISECOND;
+
+    if (!text_cp.save_binary(argv[2])) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    ConfigParser binary_cp(argv[2]);
+    binary_ms = (double)nano_from_ts(get_time_since(start_time)) / MILLISECOND;
+
+    printf("%d processes, load time: text %.3f ms, binary %.3f ms\n",
+        binary_cp.procs, text_ms, binary_ms);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+
+#include "log_events.hpp"
+#include "utils.hpp"
+
+/*
+ * Renders a binary event log of tinyem (--event-log) as text, in the
+ * format of the text log. Records of different threads are interleaved
+ * in order of their flushing, times are relative to the first record.
+ */
+int main(int argc, char* argv[]) {
+    EventLogHeader header;
+    LogRecord record;
+    char buf[BUF_SIZE];
+    long long first_ts = -1, records = 0;
+    FILE* file;
+
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <event log>" << std::endl;
+        return 1;
+    }
+
+    file = fopen(argv[1], "rb");
+    if (file == nullptr) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic)) != 0
+        || header.version != EVENT_LOG_VERSION
+        || header.record_size != sizeof(LogRecord)) {
+        std::cerr << argv[1] << ": not an event log of this version" << std::endl;
+        fclose(file);
+        return 1;
+    }
+
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (first_ts < 0)
+            first_ts = record.ts;
+        struct timespec ts = ts_from_nano(record.ts - first_ts);
+
+        format_log_record(buf, sizeof(buf), record);
+        printf("[sec: %06d msec: %03d micsec: %03d][thread %d] %s\n",
+            get_sec(ts), get_msec(ts), get_micsec(ts), record.thread, buf);
+        records++;
+    }
+
+    fclose(file);
+    std::cerr << records << " records" << std::endl;
+    return 0;
+}
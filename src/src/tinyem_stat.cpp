@@ -0,0 +1,139 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "stats_page.hpp"
+#include "utils.hpp"
+
+/*
+ * Shows live counters of a running tinyem (--stats NAME), refreshed
+ * like top until the emulation ends, or dumps one snapshot as JSON.
+ */
+
+static void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [-j] [-i MS] <stats name>\n"
+              << "  -j     print one snapshot as JSON and exit\n"
+              << "  -i MS  refresh every MS milliseconds (default 500)\n";
+}
+
+static void print_json(const StatsHeader& header, const std::vector<ProcStats>& procs) {
+    printf("{\"pid\": %d, \"finished\": %s, \"wall_ns\": %lld, \"steps\": %llu, \"procs\": [",
+        header.pid, header.finished ? "true" : "false",
+        (long long)header.wall_ns, (unsigned long long)header.steps);
+    for (size_t i = 0; i < procs.size(); ++i) {
+        const ProcStats& p = procs[i];
+        printf("%s\n  {\"em_id\": %d, \"virtual_clock_ns\": %lld, \"quanta\": %llu, "
+               "\"packets_out\": %llu, \"bytes_out\": %llu, \"packets_in\": %llu, "
+               "\"bytes_in\": %llu, \"foreign\": %llu, \"dropped\": %llu, "
+               "\"in_queue\": %u, \"out_queue\": %u, \"exited\": %s}",
+            i ? "," : "", (int)i, (long long)p.virtual_clock, (unsigned long long)p.quanta,
+            (unsigned long long)p.packets_out, (unsigned long long)p.bytes_out,
+            (unsigned long long)p.packets_in, (unsigned long long)p.bytes_in,
+            (unsigned long long)p.foreign, (unsigned long long)p.dropped,
+            p.in_queue, p.out_queue, p.exited ? "true" : "false");
+    }
+    printf("\n]}\n");
+}
+
+static void print_table(const StatsHeader& header, const std::vector<ProcStats>& procs) {
+    ProcStats total;
+    memset(&total, 0, sizeof(total));
+
+    printf("\033[H\033[2J"); /* Clear screen */
+    printf("tinyem (pid %d)  %s  real time: %.3f s  steps: %llu\n\n",
+        header.pid, header.finished ? "FINISHED" : "running",
+        (double)header.wall_ns / SECOND, (unsigned long long)header.steps);
+    printf("%5s %12s %9s %9s %11s %9s %11s %7s %7s %6s %6s\n",
+        "EM_ID", "VCLOCK_MS", "QUANTA", "PKT_OUT", "BYTES_OUT", "PKT_IN",
+        "BYTES_IN", "FOREIGN", "DROPPED", "IN_Q", "OUT_Q");
+    for (size_t i = 0; i < procs.size(); ++i) {
+        const ProcStats& p = procs[i];
+        printf("%5d %12.3f %9llu %9llu %11llu %9llu %11llu %7llu %7llu %6u %6u%s\n",
+            (int)i, (double)p.virtual_clock / MILLISECOND, (unsigned long long)p.quanta,
+            (unsigned long long)p.packets_out, (unsigned long long)p.bytes_out,
+            (unsigned long long)p.packets_in, (unsigned long long)p.bytes_in,
+            (unsigned long long)p.foreign, (unsigned long long)p.dropped,
+            p.in_queue, p.out_queue, p.exited ? "  exited" : "");
+        total.packets_out += p.packets_out;
+        total.packets_in += p.packets_in;
+        total.foreign += p.foreign;
+        total.dropped += p.dropped;
+    }
+    printf("\ntotal: %llu packets out, %llu in, %llu foreign, %llu dropped\n",
+        (unsigned long long)total.packets_out, (unsigned long long)total.packets_in,
+        (unsigned long long)total.foreign, (unsigned long long)total.dropped);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    bool json = false;
+    long long interval_ms = 500;
+    std::string name;
+    struct stat st;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ji:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            json = true;
+            break;
+        case 'i':
+            interval_ms = atoll(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind + 1 != argc || interval_ms <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    name = argv[optind];
+    if (name[0] != '/')
+        name = "/" + name;
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(StatsHeader)) {
+        perror(name.c_str());
+        return 1;
+    }
+    void* segment = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        perror(name.c_str());
+        return 1;
+    }
+
+    const StatsHeader* shared = (const StatsHeader*)segment;
+    if (memcmp(shared->magic, STATS_MAGIC, sizeof(shared->magic)) != 0
+        || shared->version != STATS_VERSION
+        || (size_t)st.st_size < stats_segment_size(shared->procs)) {
+        std::cerr << name << ": not a stats segment of this version" << std::endl;
+        return 1;
+    }
+
+    StatsHeader header;
+    std::vector<ProcStats> procs(shared->procs);
+    while (true) {
+        stats_snapshot(shared, &header, procs.data());
+        if (json) {
+            print_json(header, procs);
+            break;
+        }
+        print_table(header, procs);
+        if (header.finished)
+            break;
+        real_sleep(interval_ms * MILLISECOND);
+    }
+
+    munmap(segment, st.st_size);
+    return 0;
+}